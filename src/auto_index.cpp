@@ -6,6 +6,7 @@
 // or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include <set>
+#include <deque>
 #include <cstring>
 #include <boost/array.hpp>
 #include <boost/exception/all.hpp>
@@ -13,8 +14,7 @@
 #include "auto_index.hpp"
 
 std::string infile, outfile, prefix, last_primary, last_secondary, last_tertiary;
-std::set<index_info> index_terms;
-std::set<std::pair<std::string, std::string> > found_terms;
+index_term_set index_terms;
 bool no_duplicates = false;
 bool verbose = false;
 bool use_section_names = true;
@@ -24,6 +24,7 @@ std::list<id_rewrite_rule> id_rewrite_list;
 bool internal_indexes = false;
 std::string internal_index_type = "section";
 boost::regex debug;
+ignore_map ignored_content;
 file_scanner_set_type file_scanner_set;
 
 int help()
@@ -87,16 +88,16 @@ const std::string* find_attr(boost::tiny_xml::element_ptr node, const char* name
    return 0;
 }
 //
-// Get the ID of the current block scope, basically
+// Get the current block scope, basically
 // move up the XML tree until we find a valid ID:
 //
-const std::string* get_current_block_id(node_id const* id)
+node_id* get_current_block_scope(node_id* id)
 {
    while((id->id == 0) && (id->prev))
       id = id->prev;
    if(!id->id)
       BOOST_THROW_EXCEPTION(std::runtime_error("Current XML block has no enclosing ID: XML is not valid Boostbook?"));
-   return id->id;
+   return id;
 }
 //
 // Get the title of the current block scope, basically
@@ -114,36 +115,169 @@ const std::string& get_current_block_title(title_info const* id)
 //
 std::string get_consolidated_content(boost::tiny_xml::element_ptr node)
 {
+   //
+   // Gather the text of the whole subtree in document order, each child preceded by
+   // a space, then normalise the whitespace once at the end (normalising each child's
+   // text as well would make no difference, since it's always surrounded by spaces):
+   //
    std::string result(node->content);
-   for(boost::tiny_xml::element_list::const_iterator i = node->elements.begin();
-      i != node->elements.end(); ++i)
+   typedef std::pair<const boost::tiny_xml::element*, boost::tiny_xml::element_list::const_iterator> frame;
+   std::vector<frame> stack(1, frame(node.get(), node->elements.begin()));
+   while(!stack.empty())
    {
+      frame& f = stack.back();
+      if(f.second == f.first->elements.end())
+      {
+         stack.pop_back();
+         continue;
+      }
+      const boost::tiny_xml::element& child = **f.second++;
       result += " ";
-      result += get_consolidated_content(*i);
+      result += child.content;
+      if(!child.elements.empty())
+         stack.push_back(frame(&child, child.elements.begin()));
    }
    static const boost::regex e("(^[[:space:]]+)|([[:space:]]+)|([[:space:]]+$)");
    return regex_replace(result, e, "(?2 )", boost::regex_constants::format_all);
 }
 //
-// Rewrite a title based on any rewrite rules we may have:
+// The rewrite rules combined into two expressions, one for the rules based on
+// the id and one for those based on the title, in which each rule is a marked
+// sub-expression: a single match then finds the first rule of each kind that
+// applies.  Rules that refer to their own sub-expressions by number can't be
+// combined, in which case each rule is tried in turn:
 //
-std::string rewrite_title(const std::string& title, const std::string& id)
+namespace
 {
-   for(std::list<id_rewrite_rule>::const_iterator i = id_rewrite_list.begin(); i != id_rewrite_list.end(); ++i)
+   struct rewrite_alternative
+   {
+      std::size_t mark;            // Sub-expression of the combined expression.
+      std::size_t position;        // In id_rewrite_list.
+      const id_rewrite_rule* rule;
+   };
+
+   struct combined_rewrite_rules
+   {
+      std::size_t rule_count;      // The size of id_rewrite_list when we were built.
+      bool combined;
+      boost::regex by_id, by_title;
+      std::vector<rewrite_alternative> id_rules, title_rules;
+
+      combined_rewrite_rules() : rule_count(0), combined(false) {}
+   };
+
+   bool can_combine(const std::string& e)
    {
-      if(i->base_on_id)
+      for(std::string::size_type i = 0; i + 1 < e.size(); ++i)
       {
-         if(regex_match(id, i->id))
-            return i->new_name;
+         if((e[i] == '\\') && (std::isdigit(static_cast<unsigned char>(e[i + 1])) || (e[i + 1] == 'g') || (e[i + 1] == 'k')))
+            return false;
+         if((e[i] == '(') && (e.compare(i + 1, 2, "?(") == 0))
+            return false;
       }
-      else
+      return true;
+   }
+
+   bool combine_rules(bool base_on_id, boost::regex& combined, std::vector<rewrite_alternative>& alternatives)
+   {
+      std::string e;
+      std::size_t mark = 1, position = 0;
+      for(std::list<id_rewrite_rule>::const_iterator i = id_rewrite_list.begin(); i != id_rewrite_list.end(); ++i, ++position)
+      {
+         if(i->base_on_id != base_on_id)
+            continue;
+         if(!can_combine(i->id.str()))
+            return false;
+         rewrite_alternative a = { mark, position, &*i };
+         alternatives.push_back(a);
+         if(e.size())
+            e += "|";
+         e += "(" + i->id.str() + ")";
+         mark += 1 + i->id.mark_count();
+      }
+      if(alternatives.empty())
+         return true;
+      combined.assign(e);
+      return combined.mark_count() + 1 == mark;
+   }
+
+   const combined_rewrite_rules& get_rewrite_rules()
+   {
+      static combined_rewrite_rules rules;
+      if(rules.rule_count != id_rewrite_list.size())
+      {
+         rules = combined_rewrite_rules();
+         rules.rule_count = id_rewrite_list.size();
+         rules.combined = combine_rules(true, rules.by_id, rules.id_rules) && combine_rules(false, rules.by_title, rules.title_rules);
+      }
+      return rules;
+   }
+   //
+   // The first of alternatives that matched in what:
+   //
+   const rewrite_alternative* matched_rule(const boost::smatch& what, const std::vector<rewrite_alternative>& alternatives)
+   {
+      for(std::vector<rewrite_alternative>::const_iterator i = alternatives.begin(); i != alternatives.end(); ++i)
+      {
+         if(what[i->mark].matched)
+            return &*i;
+      }
+      return 0;
+   }
+}
+//
+// Rewrite a title based on any rewrite rules we may have:
+//
+std::string rewrite_title(const std::string& title, const std::string& id)
+{
+   const combined_rewrite_rules& rules = get_rewrite_rules();
+   if(!rules.combined)
+   {
+      for(std::list<id_rewrite_rule>::const_iterator i = id_rewrite_list.begin(); i != id_rewrite_list.end(); ++i)
       {
-         if(regex_match(title, i->id))
-            return regex_replace(title, i->id, i->new_name);
+         if(i->base_on_id)
+         {
+            if(regex_match(id, i->id))
+               return i->new_name;
+         }
+         else
+         {
+            if(regex_match(title, i->id))
+               return regex_replace(title, i->id, i->new_name);
+         }
       }
+      return title;
    }
+   boost::smatch what;
+   const rewrite_alternative* by_id = 0;
+   const rewrite_alternative* by_title = 0;
+   if(!rules.id_rules.empty() && regex_match(id, what, rules.by_id))
+      by_id = matched_rule(what, rules.id_rules);
+   if(!rules.title_rules.empty() && (!by_id || (rules.title_rules.front().position < by_id->position)) && regex_match(title, what, rules.by_title))
+      by_title = matched_rule(what, rules.title_rules);
+   if(by_id && (!by_title || (by_id->position < by_title->position)))
+      return by_id->rule->new_name;
+   if(by_title)
+      return regex_replace(title, by_title->rule->id, by_title->rule->new_name);
    return title;
 }
+//
+// Get the title of the current block scope as rewritten by the rewrite rules:
+// every block in a section shares the title, so the result is cached in the
+// scope that the title belongs to:
+//
+const std::string& get_rewritten_block_title(title_info* t, const std::string& id)
+{
+   while((t->title.size() == 0) && (t->prev))
+      t = t->prev;
+   if(!t->have_rewritten || (t->rewritten_id != id))
+   {
+      t->rewritten = rewrite_title(t->title, id);
+      t->rewritten_id = id;
+      t->have_rewritten = true;
+   }
+   return t->rewritten;
+}
 
 struct string_cmp
 {
@@ -173,10 +307,7 @@ bool can_contain_title(const char* name)
        "setindexinfo", "setinfo", "sidebar", "sidebarinfo", "simplesect", "step", "table", "task", "taskprerequisites", 
        "taskrelated", "tasksummary", "tip", "toc", "variablelist", "warning", "refentry"
    } };
-   static std::set<const char*, string_cmp> permitted;
-
-   if(permitted.empty())
-      permitted.insert(names.begin(), names.end());
+   static const std::set<const char*, string_cmp> permitted(names.begin(), names.end());
 
    return 0 != permitted.count(name);
 }
@@ -217,10 +348,7 @@ bool can_contain_indexterm(const char* name)
       "titleabbrev", "tocback", "tocentry", "tocfront", "token", "type", "ulink", "uri", "userinput", "variablelist", 
       "varname", "volumenum", "warning", "wordasword", "year"
    } };
-   static std::set<const char*, string_cmp> permitted;
-
-   if(permitted.empty())
-      permitted.insert(names.begin(), names.end());
+   static const std::set<const char*, string_cmp> permitted(names.begin(), names.end());
 
    return 0 != permitted.count(name);
 }
@@ -252,22 +380,9 @@ bool should_flatten_node(const char* name)
       /*"biblioentry", "bibliomixed", "callout", "glossentry", "listitem", "seg", "seglistitem", "member",
       "term", */
    } };
-   static std::set<const char*, string_cmp> terminals;
-
-   if(terminals.empty())
-         terminals.insert(names.begin(), names.end());
+   static const std::set<const char*, string_cmp> terminals(names.begin(), names.end());
    return 0 != terminals.count(name);
 }
-std::string unescape_xml(const std::string& s)
-{
-   boost::regex e("&(?:(quot)|(amp)|(apos)|(lt)|(gt));");
-   return regex_replace(s, e, "(?1\")(?2&)(?3\')(?4<)(?5>)", boost::regex_constants::format_all);
-}
-//
-// Exception classes to propagate processing instruction info:
-//
-struct ignore_section{};
-struct ignore_block{};
 //
 // Check if we're in a section (or chapter etc) or not:
 //
@@ -279,9 +394,7 @@ bool is_section(const std::string& name)
       "reference", "part", "article", "appendix", "index", "setindex", "colophon",
       "sect1", "refentry", "simplesect", "section", "partintro"
    }};
-   std::set<std::string> names;
-   if(names.empty())
-      names.insert(data.begin(), data.end());
+   static const std::set<std::string> names(data.begin(), data.end());
    return 0 != names.count(name);
 }
 //
@@ -303,101 +416,429 @@ bool is_block(const std::string& name)
       "sidebar", "qandaset", "task", "productionset", "constraintdef", "anchor", 
       "bridgehead", "remark", "highlights", "abstract", "authorblurb", "epigraph"
    }};
-   std::set<std::string> names;
-   if(names.empty())
-      names.insert(data.begin(), data.end());
+   static const std::set<std::string> names(data.begin(), data.end());
    return 0 != names.count(name);
 }
 //
-// Helper proc to recurse through children:
+// Generated BoostBook repeats a lot of identical text ("Returns:", "Throws: Nothing."
+// and the like), so we remember which terms were found in each block of text,
+// and only scan it once.  The ID constraints and duplicate checks depend on where
+// the text is, so those still get applied for each occurrence:
 //
-void process_node(boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, bool seen);
-bool recurse_through_children(boost::tiny_xml::element_ptr node, node_id* id, title_info* pt, bool seen)
+namespace
 {
-   try
+   const std::size_t max_cached_blocks = 1u << 16;
+
+   boost::unordered_map<std::string, term_hits> match_cache;
+   std::size_t match_cache_lookups = 0;
+   std::size_t match_cache_hits = 0;
+}
+
+//
+// Finds the terms present in text, this touches nothing but the terms, so may
+// be called from any thread:
+//
+void match_terms(const std::string& text, term_hits& hits)
+{
+   // Lower case copy of the text for case folded terms, created when first needed:
+   std::string folded_text;
+   bool have_folded_text = false;
+   hits.clear();
+   for(index_term_set::const_iterator i = index_terms.begin();
+         i != index_terms.end(); ++i)
    {
-      for(boost::tiny_xml::element_list::const_iterator i = node->elements.begin();
-         i != node->elements.end(); ++i)
+      const std::string* psearch = &text;
+      if(i->search_text.case_folded())
       {
-         process_node(*i, id, pt, seen);
+         if(!have_folded_text)
+         {
+            fold_case(text, folded_text);
+            have_folded_text = true;
+         }
+         psearch = &folded_text;
       }
+      if(i->search_text.search(*psearch))
+         hits.push_back(&*i);
+   }
+}
+
+const term_hits& find_matching_terms(const std::string& text, term_hits& storage)
+{
+   ++match_cache_lookups;
+   boost::unordered_map<std::string, term_hits>::iterator pos = match_cache.find(text);
+   if(pos != match_cache.end())
+   {
+      ++match_cache_hits;
+      return pos->second;
    }
-   catch(const ignore_section&)
+   match_terms(text, storage);
+   if(match_cache.size() < max_cached_blocks)
    {
-      if(is_section(node->name))
-         return false;
-      else
-         throw;
+      term_hits& hits = match_cache[text];
+      hits.swap(storage);
+      return hits;
    }
-   catch(const ignore_block&)
+   return storage;
+}
+
+void print_match_cache_statistics()
+{
+   std::cout << "Text match cache: " << match_cache_hits << " hits from " << match_cache_lookups << " lookups";
+   if(match_cache_lookups)
+      std::cout << " (" << (100 * match_cache_hits / match_cache_lookups) << "%)";
+   std::cout << ", " << match_cache.size() << " blocks of text cached." << std::endl;
+}
+//
+// Pre-pass for the IgnoreSection and IgnoreBlock processing instructions: walks
+// the tree in the same order as process_node does, and returns what's being ignored
+// if a processing instruction inside node applies to something enclosing it:
+//
+ignore_kind find_ignored_content(const boost::tiny_xml::element_ptr& node, ignore_map& ignored)
+{
+   typedef std::pair<const boost::tiny_xml::element*, boost::tiny_xml::element_list::const_iterator> frame;
+   std::vector<frame> stack(1, frame(node.get(), node->elements.begin()));
+   // What's being ignored by the child we've just left:
+   ignore_kind k = ignore_nothing;
+   while(!stack.empty())
    {
-      if(is_block(node->name) || is_section(node->name))
-         return false;
+      frame& f = stack.back();
+      if(k != ignore_nothing)
+      {
+         // Nothing after that child gets processed:
+         boost::tiny_xml::element_list::const_iterator last = f.second;
+         ignored[f.first] = (--last)->get();
+         if(ignore_stops_at(k, f.first->name))
+            k = ignore_nothing;
+         stack.pop_back();
+      }
+      else if(f.second == f.first->elements.end())
+         stack.pop_back();
       else
-         throw;
+      {
+         const boost::tiny_xml::element& child = **f.second++;
+         if(child.name == "?BoostAutoIndex")
+         {
+            if(child.content == "IgnoreSection")
+               k = ignore_to_section;
+            else if(child.content == "IgnoreBlock")
+               k = ignore_to_block;
+         }
+         else if(child.elements.size())
+            stack.push_back(frame(&child, child.elements.begin()));
+      }
    }
-   return true;
+   return k;
 }
 //
-// This does most of the work: process the node pointed to, and any children
-// that it may have:
+// The same for a child of the element being processed when the children are
+// processed one at a time: the child may itself be the processing instruction:
 //
-void process_node(boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, bool seen = false)
+ignore_kind ignored_from(const boost::tiny_xml::element_ptr& child, ignore_map& ignored)
 {
-   //
-   // Store the current ID and title as nested scoped objects:
-   //
-   node_id id = { 0, prev };
-   if(can_contain_title(node->name.c_str()))
+   if(child->name == "?BoostAutoIndex")
    {
-      // Only set the ID to link to if the block can contain a title, see
-      // can_contain_title above for rationale.
-      id.id = find_attr(node, "id");
+      if(child->content == "IgnoreSection")
+         return ignore_to_section;
+      if(child->content == "IgnoreBlock")
+         return ignore_to_block;
+   }
+   return find_ignored_content(child, ignored);
+}
+//
+// Whether an element with this name is where processing resumes:
+//
+bool ignore_stops_at(ignore_kind k, const std::string& name)
+{
+   return is_section(name) || ((k == ignore_to_block) && is_block(name));
+}
+
+void report_unenclosed_ignore(ignore_kind k)
+{
+   if(k == ignore_to_section)
+      throw std::runtime_error("Found a <?BoostAutoIndex IgnoreSection?> processing instruction that is not inside a section.");
+   throw std::runtime_error("Found a <?BoostAutoIndex IgnoreBlock?> processing instruction that is not inside a block or section.");
+}
+//
+// The state of one element in process_node's traversal, these are kept in a
+// deque so that each id and title stays put while the element's descendants
+// refer to it:
+//
+struct node_frame
+{
+   boost::tiny_xml::element_ptr node;
+   node_id id;
+   title_info title;
+   boost::tiny_xml::element* container;         // Nearest ancestor that can contain an <indexterm>,
+   bool in_title;                               // and whether there's a <title> in between.
+   boost::tiny_xml::element* child_container;   // The same for our children.
+   bool child_in_title;
+   bool seen;                                   // Text already searched by a flattened ancestor.
+   bool flatten;                                // Search all our text in one go.
+   bool stopped;                                // An ignore processing instruction stopped us early.
+   bool indexing;                               // Not outside our share with --shard, or with --merge.
+   bool include_pending;                        // An xi:include whose file we haven't got to yet.
+   const prematched_terms* prematched;          // The terms already found in the text of an included file.
+   boost::tiny_xml::element_list::const_iterator next_child;
+   const boost::tiny_xml::element* last_child;  // Where an ignore processing instruction stops us.
+};
+//
+// Inserts an <indexterm> at the start of container:
+//
+void insert_indexterm(boost::tiny_xml::element* container, const std::string& primary, const std::string& secondary, const std::string& category, bool preferred)
+{
+   if(!container)
+   {
+      std::cerr << "Unable to find location to insert <indexterm>" << std::endl;
+      return;
    }
-   title_info title = { "", pt};
-   bool flatten = should_flatten_node(node->name.c_str());
+   boost::tiny_xml::element_ptr p(new boost::tiny_xml::element());
+   p->name = "indexterm";
+   if(category.size())
+      p->attributes.push_back(boost::tiny_xml::attribute("type", category));
+   boost::tiny_xml::element_ptr prim(new boost::tiny_xml::element());
+   prim->name = "primary";
+   prim->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
+   prim->elements.front()->content = primary;
+   p->elements.push_front(prim);
 
-   if(node->name.size() && node->name[0] == '?')
+   boost::tiny_xml::element_ptr sec(new boost::tiny_xml::element());
+   sec->name = "secondary";
+   sec->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
+   sec->elements.front()->content = secondary;
+   p->elements.push_back(sec);
+   if(preferred)
+      p->attributes.push_back(boost::tiny_xml::attribute("significance", "preferred"));
+   container->elements.push_front(p);
+   if(sharding)
+      record_indexterm(container, primary, secondary, category, preferred);
+}
+//
+// Adds the entries [first, last) to the index, each one a sub-entry of the one
+// before, and each only if it isn't there already:
+//
+void insert_index_entries(const index_entry_ptr* first, const index_entry_ptr* last)
+{
+   if(sharding)
+      record_index_entries(first, last);
+   index_entry_set* parent = &index_entries;
+   std::size_t added = 0;
+   for(; first != last; ++first)
+   {
+      std::pair<index_entry_set::iterator, bool> pos = parent->insert(*first);
+      if(pos.second)
+         ++added;
+      parent = &((*pos.first)->sub_keys);
+   }
+   if(added)
+      note_index_entries_added(added);
+}
+//
+// The options that decide what's done with each term found, as a policy for
+// the traversal below.  The usual combinations get a traversal compiled with
+// the options fixed, so nothing is tested for each hit that needn't be, the
+// rest (a script with !debug, and --dynamic-traversal for testing) read
+// them as they go:
+//
+struct dynamic_options
+{
+   static bool internal() { return internal_indexes; }
+   static bool section_names() { return use_section_names; }
+   static bool unique() { return no_duplicates; }
+   static bool debugging() { return !debug.empty(); }
+};
+
+template <bool Internal, bool SectionNames, bool Unique>
+struct fixed_options
+{
+   static bool internal() { return Internal; }
+   static bool section_names() { return SectionNames; }
+   static bool unique() { return Unique; }
+   static bool debugging() { return false; }
+};
+
+bool dynamic_traversal = false;
+//
+// Search some text belonging to the element in f, and index whatever we find:
+//
+template <class Options>
+void index_text(const std::string& text, node_frame& f)
+{
+   //
+   // Search content for items: we only search if the content is not empty, 
+   // and the content is not whitespace alone:
+   //
+   if(f.indexing && text.size() && !is_whitespace(text))
    {
-      if(node->name == "?BoostAutoIndex")
+      // Save block ID and title in case we find some hits:
+      node_id* scope = get_current_block_scope(&f.id);
+      const std::string* pid = scope->id;
+      const std::string& rtitle = get_current_block_title(&f.title);
+      // The rewritten title, and pooled copies of the above, only created once we have a hit:
+      const std::string* simple_title = 0;
+      interned_string ipid, ititle, isimple_title;
+      // Find the index terms present in the text:
+      term_hits hits_storage;
+      prematched_terms::const_iterator pre;
+      const term_hits& hits = (f.prematched && ((pre = f.prematched->find(text)) != f.prematched->end()))
+         ? pre->second : find_matching_terms(text, hits_storage);
+      for(term_hits::const_iterator h = hits.begin(); h != hits.end(); ++h)
       {
-         if(node->content == "IgnoreSection")
+         const index_info* i = *h;
+         if(ipid.empty())
          {
-            throw ignore_section();
+            simple_title = &get_rewritten_block_title(&f.title, *pid);
+            ipid = interned_string(*pid);
+            ititle = interned_string(rtitle);
+            isimple_title = interned_string(*simple_title);
          }
-         else if(node->content == "IgnoreBlock")
+         //
+         // We need to check to see if this term has already been indexed
+         // in this zone, in order to prevent duplicate entries, also check
+         // that any constrait placed on the term's ID is satisfied:
+         //
+         if((!Options::unique() || !scope->found_terms || (0 == scope->found_terms->count(i->term)))
+            && (i->search_id.empty() || regex_match(*pid, *i->search_id.get())))
          {
-            throw ignore_block();
+            // We have something to index!
+            if(Options::unique())
+            {
+               if(!scope->found_terms)
+                  scope->found_terms.reset(new found_term_set);
+               scope->found_terms->insert(i->term);
+            }
+            if(sharding)
+               record_hit(ipid, i->term);
+
+            if(Options::debugging() && (regex_match(i->term.str(), debug) || regex_match(rtitle, debug) || regex_match(*simple_title, debug)))
+            {
+               std::cout << "Debug term found, in block with ID: " << *pid << std::endl;
+               std::cout << "Current section title is: " << rtitle << std::endl;
+               std::cout << "The main index entry will be : " << *simple_title << std::endl;
+               std::cout << "The indexed term is: " << i->term << std::endl;
+               std::cout << "The search regex is: " << i->search_text << std::endl;
+               std::cout << "The section constraint is: " << i->search_id << std::endl;
+               std::cout << "The index type for this entry is: " << i->category << std::endl;
+            }
+
+            if(Options::section_names() && (isimple_title != i->term))
+            {
+               //
+               // First off insert index entry with primary term
+               // consisting of the section title, and secondary term the
+               // actual index term, this gets skipped if the title and index 
+               // term are the same:
+               //
+               if(!Options::internal())
+                  insert_indexterm(f.container, *simple_title, i->term.str(), std::string(), false);
+               // Track the entry in our internal index:
+               index_entry_ptr items[2] = { index_entry_ptr(new index_entry(isimple_title)), index_entry_ptr(new index_entry(i->term, ipid)) };
+               insert_index_entries(items, items + 2);
+            }
+            //
+            // Now insert another index entry with the index term
+            // as the primary key, and the section title as the 
+            // secondary key, this one gets assigned to the 
+            // appropriate index category if there is one:
+            //
+            // If the search text was found in a title then make it a preferred term:
+            bool preferred_term = f.in_title;
+            if(!Options::internal())
+               insert_indexterm(f.container, i->term.str(), rtitle, i->category.str(), preferred_term);
+
+            // Track the entry in our internal index:
+            index_entry_ptr item3(new index_entry(i->term));
+            if(i->category.size())
+               item3->category = i->category;
+            index_entry_ptr item4(new index_entry(ititle, ipid));
+            item4->preferred = preferred_term;
+            index_entry_ptr items[2] = { item3, item4 };
+            insert_index_entries(items, items + 2);
          }
       }
-      return; // Ignore processing instructions
    }
-   else if((node->name == "title") && (id.prev->id))
+}
+//
+// Start processing an element: deal with anything special about it and
+// push it on the stack, unless it's a processing instruction:
+//
+template <class Options>
+void enter_node(std::deque<node_frame>& stack, boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, boost::tiny_xml::element* container, bool in_title, bool seen, bool indexing)
+{
+   if(node->name.size() && node->name[0] == '?')
+   {
+      // Ignore processing instructions, find_ignored_content has dealt with ours:
+      return;
+   }
+   stack.push_back(node_frame());
+   node_frame& f = stack.back();
+   f.node = node;
+   //
+   // Store the current ID and title as nested scoped objects:
+   //
+   f.id.id = 0;
+   f.id.prev = prev;
+   if(can_contain_title(node->name.c_str()))
+   {
+      // Only set the ID to link to if the block can contain a title, see
+      // can_contain_title above for rationale.
+      f.id.id = find_attr(node, "id");
+   }
+   f.title.prev = pt;
+   f.container = container;
+   f.in_title = in_title;
+   if(can_contain_indexterm(node->name.c_str()))
+   {
+      f.child_container = node.get();
+      f.child_in_title = false;
+   }
+   else
+   {
+      f.child_container = container;
+      f.child_in_title = in_title || (node->name == "title");
+   }
+   f.seen = seen;
+   f.flatten = should_flatten_node(node->name.c_str());
+   f.stopped = false;
+   f.indexing = indexing;
+   f.include_pending = node->name == "xi:include";
+   f.prematched = stack.size() > 1 ? stack[stack.size() - 2].prematched : 0;
+   f.last_child = 0;
+   if(!ignored_content.empty())
+   {
+      ignore_map::const_iterator pos = ignored_content.find(node.get());
+      if(pos != ignored_content.end())
+         f.last_child = pos->second;
+   }
+
+   if((node->name == "title") && (f.id.prev->id))
    {
       //
       // This actually sets the title of the enclosing scope, 
       // not this tag itself:
       //
-      title.prev->title = get_consolidated_content(node);
+      f.title.prev->title = get_consolidated_content(node);
+      f.title.prev->have_rewritten = false;
       if(verbose)
-         std::cout << "Indexing section: " << title.prev->title << std::endl;
+         std::cout << "Indexing section: " << f.title.prev->title << std::endl;
    }
-   else if((node->name == "refentrytitle") && (id.prev->prev->id))
+   else if((node->name == "refentrytitle") && (f.id.prev->prev->id))
    {
       //
       // This actually sets the title of the enclosing refentry scope, 
       // not this tag itself:
       //
-      title.prev->prev->title = get_consolidated_content(node);
+      f.title.prev->prev->title = get_consolidated_content(node);
+      f.title.prev->prev->have_rewritten = false;
       if(verbose)
-         std::cout << "Indexing refentry: " << title.prev->prev->title << std::endl;
+         std::cout << "Indexing refentry: " << f.title.prev->prev->title << std::endl;
    }
    if(node->name == "anchor")
    {
       if(node->parent.lock()->name == "title")
       {
          // We have a title with a nested anchor ID, change the ID of our parents parent to match:
-         id.prev->prev->id = id.id;
+         f.id.prev->prev->id = f.id.id;
+         f.id.prev->prev->found_terms.reset();
       }
    }
    else if(node->name == "index")
@@ -419,236 +860,162 @@ void process_node(boost::tiny_xml::element_ptr node, node_id* prev, title_info*
    {
       last_tertiary = get_consolidated_content(node);
    }
-   else if((node->name == "see") && internal_indexes)
+   else if((node->name == "see") && Options::internal())
    {
       std::cerr << "WARNING: <see> in XML source will be ignored for the index generation" << std::endl;
    }
-   else if((node->name == "seealso") && internal_indexes)
+   else if((node->name == "seealso") && Options::internal())
    {
       std::cerr << "WARNING: <seealso> in XML source will be ignored for the index generation" << std::endl;
    }
 
-   std::string flattenned_text;
-   const std::string* ptext;
-   if(flatten)
-   {
-      flattenned_text = unescape_xml(get_consolidated_content(node));
-      ptext = &flattenned_text;
-      //
-      // Recurse through children here if we're going to flatten the text, that way we see any processing instructions first:
-      //
-      if(!recurse_through_children(node, &id, &title, flatten || seen))
-         return;
-   }
-   else
-   {
-      ptext = &(node->content);
-   }
-
-   //
-   // Search content for items: we only search if the content is not empty, 
-   // and the content is not whitespace alone, and we haven't already searched this
-   // text in one of our parent nodes that got flattened.
-   //
-   static const boost::regex space_re("[[:space:]]+");
-   if(!seen && ptext->size() && !regex_match(*ptext, space_re))
-   {
-      // Save block ID and title in case we find some hits:
-      const std::string* pid = get_current_block_id(&id);
-      const std::string& rtitle = get_current_block_title(&title);
-      const std::string simple_title = rewrite_title(rtitle, *pid);
-      // Scan for each index term:
-      for(std::set<index_info>::const_iterator i = index_terms.begin();
-            i != index_terms.end(); ++i)
-      {
-         if(regex_search(*ptext, i->search_text))
-         {
-            //
-            // We need to check to see if this term has already been indexed
-            // in this zone, in order to prevent duplicate entries, also check
-            // that any constrait placed on the term's ID is satisfied:
-            //
-            std::pair<std::string, std::string> item_index(*pid, i->term);
-            if(((no_duplicates == false) || (0 == found_terms.count(item_index))) 
-               && (i->search_id.empty() || regex_match(*pid, i->search_id)))
-            {
-               // We have something to index!
-               found_terms.insert(item_index);
-
-               if(!debug.empty() && (regex_match(i->term, debug) || regex_match(rtitle, debug) || regex_match(simple_title, debug)))
-               {
-                  std::cout << "Debug term found, in block with ID: " << *pid << std::endl;
-                  std::cout << "Current section title is: " << rtitle << std::endl;
-                  std::cout << "The main index entry will be : " << simple_title << std::endl;
-                  std::cout << "The indexed term is: " << i->term << std::endl;
-                  std::cout << "The search regex is: " << i->search_text << std::endl;
-                  std::cout << "The section constraint is: " << i->search_id << std::endl;
-                  std::cout << "The index type for this entry is: " << i->category << std::endl;
-               }
-
-               if(use_section_names && (simple_title != i->term))
-               {
-                  //
-                  // First off insert index entry with primary term
-                  // consisting of the section title, and secondary term the
-                  // actual index term, this gets skipped if the title and index 
-                  // term are the same:
-                  //
-                  if(internal_indexes == false)
-                  {
-                     // Insert an <indexterm> into the XML:
-                     boost::tiny_xml::element_ptr p(new boost::tiny_xml::element());
-                     p->name = "indexterm";
-                     boost::tiny_xml::element_ptr prim(new boost::tiny_xml::element());
-                     prim->name = "primary";
-                     prim->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
-                     prim->elements.front()->content = simple_title;
-                     p->elements.push_front(prim);
-
-                     boost::tiny_xml::element_ptr sec(new boost::tiny_xml::element());
-                     sec->name = "secondary";
-                     sec->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
-                     sec->elements.front()->content = i->term;
-                     p->elements.push_back(sec);
-                     try{
-                        // Insert the Indexterm:
-                        boost::tiny_xml::element_ptr parent(node->parent);
-                        while(!can_contain_indexterm(parent->name.c_str()))
-                           parent = parent->parent.lock();
-                        parent->elements.push_front(p);
-                     }
-                     catch(const std::exception&)
-                     {
-                        std::cerr << "Unable to find location to insert <indexterm>" << std::endl;
-                     }
-                  }
-                  // Track the entry in our internal index:
-                  index_entry_ptr item1(new index_entry(simple_title));
-                  index_entry_ptr item2(new index_entry(i->term, *pid));
-                  index_entry_set::iterator pos = index_entries.insert(item1).first;
-                  (**pos).sub_keys.insert(item2);
-               }
-               //
-               // Now insert another index entry with the index term
-               // as the primary key, and the section title as the 
-               // secondary key, this one gets assigned to the 
-               // appropriate index category if there is one:
-               //
-               bool preferred_term = false;
-               if(internal_indexes == false)
-               {
-                  // Insert <indexterm> into the XML:
-                  boost::tiny_xml::element_ptr p2(new boost::tiny_xml::element());
-                  p2->name = "indexterm";
-                  if(i->category.size())
-                  {
-                     p2->attributes.push_back(boost::tiny_xml::attribute("type", i->category));
-                  }
-                  boost::tiny_xml::element_ptr prim2(new boost::tiny_xml::element());
-                  prim2->name = "primary";
-                  prim2->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
-                  prim2->elements.front()->content = i->term;
-                  p2->elements.push_front(prim2);
-
-                  boost::tiny_xml::element_ptr sec2(new boost::tiny_xml::element());
-                  sec2->name = "secondary";
-                  sec2->elements.push_front(boost::tiny_xml::element_ptr(new boost::tiny_xml::element()));
-                  sec2->elements.front()->content = rtitle;
-                  p2->elements.push_back(sec2);
-                  try{
-                     // Insert the Indexterm:
-                     boost::tiny_xml::element_ptr parent(node->parent);
-                     while(!can_contain_indexterm(parent->name.c_str()))
-                     {
-                        // If the search text was found in a title then make it a preferred term:
-                        if(parent->name == "title")
-                           preferred_term = true;
-                        parent = parent->parent.lock();
-                     }
-                     if(preferred_term)
-                     {
-                        boost::tiny_xml::attribute a("significance", "preferred");
-                        p2->attributes.push_back(a);
-                     }
-                     parent->elements.push_front(p2);
-                  }
-                  catch(const std::exception&)
-                  {
-                     std::cerr << "Unable to find location to insert <indexterm>" << std::endl;
-                  }
-               }
-               
-               // Track the entry in our internal index:
-               try{
-                  // figure out if it's preferred or not:
-                  boost::tiny_xml::element_ptr parent(node->parent);
-                  while(!can_contain_indexterm(parent->name.c_str()))
-                  {
-                     // If the search text was found in a title then make it a preferred term:
-                     if(parent->name == "title")
-                     {
-                        preferred_term = true;
-                     }
-                     parent = parent->parent.lock();
-                     if(!parent)
-                        break;
-                  }
-               }
-               catch(const std::exception&){}
-
-               index_entry_ptr item3(new index_entry(i->term));
-               if(i->category.size())
-                  item3->category = i->category;
-               index_entry_ptr item4(new index_entry(rtitle, *pid));
-               item4->preferred = preferred_term;
-               index_entry_set::iterator pos = index_entries.insert(item3).first;
-               (**pos).sub_keys.insert(item4);
-            }
-         }
-      }
-   }
    //
-   // Recurse through children, if not done already:
+   // If we're going to flatten the text then we search it after processing the
+   // children, that way we see any processing instructions first:
    //
-   if(!flatten)
-      recurse_through_children(node, &id, &title, flatten || seen);
+   if(!f.flatten && !f.seen)
+      index_text<Options>(node->content, f);
+   f.next_child = node->elements.begin();
+}
+//
+// Finish processing an element once all its children are done:
+//
+template <class Options>
+void leave_node(node_frame& f)
+{
+   if(f.stopped)
+      return;
+   if(f.flatten && !f.seen)
+      index_text<Options>(unescape_xml(get_consolidated_content(f.node)), f);
    //
    // Process manual index entries last of all:
    //
-   if(node->name == "indexterm")
+   if(f.node->name == "indexterm")
    {
-      // Track the entry in our internal index:
-      const std::string* pid = get_current_block_id(&id);
-      const std::string* attr = find_attr(node, "type");
-      const std::string& rtitle = get_current_block_title(&title);
-      const std::string simple_title = rewrite_title(rtitle, *pid);
-      index_entry_ptr item1(new index_entry(last_primary, "", attr ? *attr : ""));
-      index_entry_set* parent = &((*index_entries.insert(item1).first)->sub_keys);
-
-      if(last_secondary.size())
-      {
-         item1.reset(new index_entry(last_secondary, "", attr ? *attr : ""));
-         parent = &((*parent->insert(item1).first)->sub_keys);
-      }
-      if(last_tertiary.size())
+      if(f.indexing)
       {
-         item1.reset(new index_entry(last_tertiary, "", attr ? *attr : ""));
-         parent = &((*parent->insert(item1).first)->sub_keys);
+         // Track the entry in our internal index:
+         const std::string* pid = get_current_block_scope(&f.id)->id;
+         const std::string* attr = find_attr(f.node, "type");
+         const std::string& simple_title = get_rewritten_block_title(&f.title, *pid);
+         const interned_string category(attr ? *attr : std::string());
+         index_entry_ptr items[4];
+         std::size_t n = 0;
+         items[n++].reset(new index_entry(interned_string(last_primary), interned_string(), category));
+         if(last_secondary.size())
+            items[n++].reset(new index_entry(interned_string(last_secondary), interned_string(), category));
+         if(last_tertiary.size())
+            items[n++].reset(new index_entry(interned_string(last_tertiary), interned_string(), category));
+         items[n++].reset(new index_entry(interned_string(simple_title), interned_string(*pid), category));
+         if(sharding)
+            record_manual_entry();
+         insert_index_entries(items, items + n);
       }
-      item1.reset(new index_entry(simple_title, *pid, attr ? *attr : ""));
-      parent->insert(item1);
-
       last_primary = "";
       last_secondary = "";
       last_tertiary = "";
    }
 }
+//
+// This does most of the work: process the node pointed to, and any children
+// that it may have.  container is the nearest ancestor of the node that can
+// contain an <indexterm> (null if there isn't one), and in_title is true if there's
+// a <title> between the two, these get passed down as we go so that we don't
+// have to search back up the tree every time we find something.  The traversal
+// uses an explicit stack, so there's no limit on how deeply nested the XML can be:
+//
+template <class Options>
+void traverse(boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, boost::tiny_xml::element* container, bool in_title, bool seen)
+{
+   std::deque<node_frame> stack;
+   enter_node<Options>(stack, node, prev, pt, container, in_title, seen, indexes_document_root());
+   const std::size_t top_level_children = node->elements.size();
+   std::size_t top_level_child = 0;
+   while(!stack.empty())
+   {
+      node_frame& f = stack.back();
+      if(f.next_child != f.node->elements.end())
+      {
+         boost::tiny_xml::element_ptr child = *f.next_child++;
+         if(child.get() == f.last_child)
+         {
+            // Nothing after this child gets processed, and we're done once it is:
+            f.next_child = f.node->elements.end();
+            f.stopped = true;
+         }
+         bool indexing = f.indexing;
+         if(stack.size() == 1)
+            indexing = indexes_top_level_child(top_level_child++, top_level_children);
+         enter_node<Options>(stack, child, &f.id, &f.title, f.child_container, f.child_in_title, f.seen || f.flatten, indexing);
+      }
+      else if(f.include_pending)
+      {
+         //
+         // With --xinclude the root of the included file is processed as if
+         // it were the last child of the xi:include:
+         //
+         f.include_pending = false;
+         const prematched_terms* terms = 0;
+         boost::tiny_xml::element_ptr root = included_document(f.node.get(), terms);
+         if(root)
+         {
+            ignore_kind k = find_ignored_content(root, ignored_content);
+            if(k != ignore_nothing)
+               report_unenclosed_ignore(k);
+            f.prematched = terms;
+            enter_node<Options>(stack, root, &f.id, &f.title, f.child_container, f.child_in_title, f.seen || f.flatten, f.indexing);
+         }
+      }
+      else
+      {
+         leave_node<Options>(f);
+         stack.pop_back();
+      }
+   }
+}
+//
+// Picks the traversal for the options in force:
+//
+void process_node(boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, boost::tiny_xml::element* container, bool in_title, bool seen)
+{
+   typedef void (*traversal)(boost::tiny_xml::element_ptr, node_id*, title_info*, boost::tiny_xml::element*, bool, bool);
+   static const traversal fixed[8] =
+   {
+      &traverse<fixed_options<false, false, false> >,
+      &traverse<fixed_options<false, false, true> >,
+      &traverse<fixed_options<false, true, false> >,
+      &traverse<fixed_options<false, true, true> >,
+      &traverse<fixed_options<true, false, false> >,
+      &traverse<fixed_options<true, false, true> >,
+      &traverse<fixed_options<true, true, false> >,
+      &traverse<fixed_options<true, true, true> >,
+   };
+   traversal t = &traverse<dynamic_options>;
+   if(!dynamic_traversal && debug.empty())
+      t = fixed[(internal_indexes ? 4 : 0) + (use_section_names ? 2 : 0) + (no_duplicates ? 1 : 0)];
+   t(node, prev, pt, container, in_title, seen);
+}
+
+//
+// Makes sure that the threads following xi:includes have finished, however
+// we leave main:
+//
+struct includes_guard
+{
+   ~includes_guard()
+   {
+      end_includes();
+   }
+};
 
 void process_nodes(boost::tiny_xml::element_ptr node)
 {
-   node_id id = { 0, };
-   title_info t = { "", 0 };
-   process_node(node, &id, &t);
+   node_id id;
+   title_info t;
+   ignore_kind k = find_ignored_content(node, ignored_content);
+   if(k != ignore_nothing)
+      report_unenclosed_ignore(k);
+   process_node(node, &id, &t, 0, false, false);
 }
 
 int main(int argc, char* argv[])
@@ -660,15 +1027,26 @@ int main(int argc, char* argv[])
    desc.add_options()
       ("help", "Print help message")
       ("in", po::value<std::string>(), "Set the input XML file.")
-      ("out", po::value<std::string>(), "Set output input XML file.")
+      ("out,o", po::value<std::string>(), "Set output input XML file.")
       ("scan", po::value<std::string>(), "Scan the specified file for terms to try and index.")
-      ("script", po::value<std::string>(), "Specifies the script file to use.")
+      ("script", po::value<std::string>(), "Specifies the script file to use, either a text script or one compiled with --compile-script.")
+      ("compile-script", po::value<std::string>(), "Processes the specified script file, and saves the resulting terms to the file given by --out in a form that loads quickly.")
       ("no-duplicates", "Prevents duplicate index entries within the same section.")
       ("no-section-names", "Suppresses use of section names as index entries.")
       ("internal-index", "Causes AutoIndex to generate the index itself, rather than relying on the XSL stylesheets.")
       ("verbose", "Turns on verbose mode.")
       ("prefix", po::value<std::string>(), "Sets the prefix to be prepended to all file names and paths in the script file.")
       ("index-type", po::value<std::string>(), "Sets the XML container type to use the index.")
+      ("pipeline", po::value<unsigned>()->implicit_value(8), "Parses, indexes and writes the top level sections of the document concurrently, the optional value sets how many sections may be queued between each stage.")
+      ("shard", po::value<std::string>(), "Indexes only the i'th of N shares of the top level sections of the document, given as i/N, and saves the results to the file given by --out for --merge to combine.")
+      ("merge", po::value<std::vector<std::string> >()->multitoken(), "Combines the shard files created by indexing the document given by --in with --shard, and writes the indexed document to the file given by --out.")
+      ("save-entries", po::value<std::string>(), "Saves the index entries created to the specified file, in a binary form that --load-entries can read.")
+      ("load-entries", po::value<std::vector<std::string> >()->multitoken(), "Merges the index entries saved by --save-entries in the specified files into those created from the document, before any internal indexes are generated.")
+      ("master-index", po::value<std::vector<std::string> >()->multitoken(), "Generates internal indexes that also cover the documents whose index entries were saved by --save-entries in the specified files, each may be given as namespace=file to prefix that document's links with \"namespace.\".")
+      ("export-index", po::value<std::string>(), "Writes the index entries created to the specified file as JSON, for use by other tools.")
+      ("memory-limit", po::value<unsigned>(), "Sets the most memory, in kilobytes, that the index entries (and with --pipeline, the sections waiting to be written) may use, beyond which they are kept in temporary files.  --save-entries and --export-index still need all the index entries in memory.")
+      ("xinclude", "Indexes the files included by xi:include elements as well as the document, each is written next to the original with .auto_index inserted before its extension.")
+      ("dynamic-traversal", "For testing: indexes the document with the traversal that reads the options as it goes, rather than one compiled for them.")
    ;
 
    po::variables_map vm;
@@ -683,6 +1061,29 @@ int main(int argc, char* argv[])
       std::cout << desc;
       return 0;
    }
+   if(vm.count("verbose"))
+   {
+      verbose = true;
+   }
+   if(vm.count("dynamic-traversal"))
+   {
+      dynamic_traversal = true;
+   }
+   if(vm.count("prefix"))
+   {
+      prefix = vm["prefix"].as<std::string>();
+   }
+   if(vm.count("compile-script"))
+   {
+      if(!vm.count("out"))
+      {
+         std::cerr << "No output file specified for the compiled script" << std::endl;
+         return 1;
+      }
+      process_script(vm["compile-script"].as<std::string>());
+      save_compiled_script(vm["out"].as<std::string>());
+      return 0;
+   }
    if(vm.count("in"))
    {
       infile = vm["in"].as<std::string>();
@@ -701,14 +1102,6 @@ int main(int argc, char* argv[])
       std::cerr << "No output XML file specified" << std::endl;
       return 1;
    }
-   if(vm.count("verbose"))
-   {
-      verbose = true;
-   }
-   if(vm.count("prefix"))
-   {
-      prefix = vm["prefix"].as<std::string>();
-   }
    if(vm.count("scan"))
    {
       std::string f = vm["scan"].as<std::string>();
@@ -718,7 +1111,11 @@ int main(int argc, char* argv[])
    }
    if(vm.count("script"))
    {
-      process_script(vm["script"].as<std::string>());
+      std::string script = vm["script"].as<std::string>();
+      if(is_compiled_script(script))
+         load_compiled_script(script);
+      else
+         process_script(script);
    }
    if(vm.count("no-duplicates"))
    {
@@ -728,7 +1125,7 @@ int main(int argc, char* argv[])
    {
       use_section_names = false;
    }
-   if(vm.count("internal-index"))
+   if(vm.count("internal-index") || vm.count("master-index"))
    {
       internal_indexes = true;
    }
@@ -736,6 +1133,10 @@ int main(int argc, char* argv[])
    {
       internal_index_type = vm["index-type"].as<std::string>();
    }
+   if(vm.count("memory-limit"))
+   {
+      set_memory_limit(static_cast<boost::uintmax_t>(vm["memory-limit"].as<unsigned>()) * 1024);
+   }
 
    std::ifstream is(infile.c_str());
    if((0 == is.peek()) || !is.good())
@@ -747,20 +1148,121 @@ int main(int argc, char* argv[])
    // We need to skip any leading <? and <! elements:
    //
    std::string header = get_header(is);
+   if(vm.count("pipeline") && (vm.count("shard") || vm.count("merge") || vm.count("load-entries") || vm.count("master-index")))
+   {
+      std::cerr << "--pipeline can not be combined with --shard, --merge, --load-entries or --master-index" << std::endl;
+      return 1;
+   }
+   if(vm.count("xinclude") && (vm.count("pipeline") || vm.count("shard") || vm.count("merge")))
+   {
+      std::cerr << "--xinclude can not be combined with --pipeline, --shard or --merge" << std::endl;
+      return 1;
+   }
+   if(vm.count("pipeline"))
+   {
+      std::cout << "Indexing " << index_terms.size() << " terms..." << std::endl;
+      process_nodes_pipelined(is, header, outfile, vm["pipeline"].as<unsigned>());
+      std::cout << count_index_entries() << " Index entries were created." << std::endl;
+      if(vm.count("save-entries") || vm.count("export-index"))
+         merge_spilled_index_entries();
+      if(vm.count("save-entries"))
+         save_index_entries(index_entries, vm["save-entries"].as<std::string>());
+      if(vm.count("export-index"))
+         export_index_entries(index_entries, vm["export-index"].as<std::string>());
+      if(verbose)
+         print_match_cache_statistics();
+      return 0;
+   }
+   if(!internal_indexes && !vm.count("shard") && !vm.count("merge") && !vm.count("xinclude"))
+   {
+      //
+      // Nothing needs the whole document once it's been indexed, so each part
+      // of it is written out, and released, as soon as it's done:
+      //
+      std::cout << "Indexing " << index_terms.size() << " terms..." << std::endl;
+      process_nodes_streamed(is, header, outfile);
+      if(vm.count("save-entries") || vm.count("export-index"))
+         merge_spilled_index_entries();
+      if(vm.count("save-entries"))
+         save_index_entries(index_entries, vm["save-entries"].as<std::string>());
+      if(vm.count("load-entries"))
+      {
+         const std::vector<std::string>& files = vm["load-entries"].as<std::vector<std::string> >();
+         for(std::vector<std::string>::const_iterator i = files.begin(); i != files.end(); ++i)
+            load_index_entries(*i, index_entries);
+      }
+      if(vm.count("export-index"))
+         export_index_entries(index_entries, vm["export-index"].as<std::string>());
+      std::cout << count_index_entries() << " Index entries were created." << std::endl;
+      if(verbose)
+         print_match_cache_statistics();
+      return 0;
+   }
    boost::tiny_xml::element_ptr xml = boost::tiny_xml::parse(is, "");
    is.close();
+   includes_guard guard;
+   if(vm.count("xinclude"))
+      begin_includes(xml, infile, outfile);
 
-   std::cout << "Indexing " << index_terms.size() << " terms..." << std::endl;
-
-   process_nodes(xml);
+   if(vm.count("shard"))
+   {
+      unsigned index = 0, count = 0;
+      char slash = 0;
+      std::istringstream ss(vm["shard"].as<std::string>());
+      if(!(ss >> index >> slash >> count) || (slash != '/') || !ss.eof())
+         throw std::runtime_error("The shard to process must be given as i/N, where i is between 1 and N.");
+      begin_shard(xml, index, count);
+      std::cout << "Indexing " << index_terms.size() << " terms..." << std::endl;
+      process_nodes(xml);
+      save_shard(outfile);
+      if(verbose)
+         print_match_cache_statistics();
+      return 0;
+   }
+   if(vm.count("merge"))
+   {
+      //
+      // Set up the titles and ids and find the indexes, then replay the shards:
+      //
+      begin_merge();
+      process_nodes(xml);
+      merge_shards(xml, vm["merge"].as<std::vector<std::string> >());
+   }
+   else
+   {
+      std::cout << "Indexing " << index_terms.size() << " terms..." << std::endl;
+      process_nodes(xml);
+   }
 
+   //
+   // The entries spilled with --memory-limit are only all brought back into
+   // memory to be saved or exported, generate_indexes merges them as it goes:
+   //
+   if(vm.count("save-entries") || vm.count("export-index"))
+      merge_spilled_index_entries();
+   if(vm.count("save-entries"))
+      save_index_entries(index_entries, vm["save-entries"].as<std::string>());
+   if(vm.count("load-entries"))
+   {
+      const std::vector<std::string>& files = vm["load-entries"].as<std::vector<std::string> >();
+      for(std::vector<std::string>::const_iterator i = files.begin(); i != files.end(); ++i)
+         load_index_entries(*i, index_entries);
+   }
+   if(vm.count("master-index"))
+      load_master_index(vm["master-index"].as<std::vector<std::string> >(), index_entries);
+   if(vm.count("export-index"))
+      export_index_entries(index_entries, vm["export-index"].as<std::string>());
    if(internal_indexes)
       generate_indexes();
 
-   std::ofstream os(outfile.c_str());
-   os << header << std::endl;
-   boost::tiny_xml::write(*xml, os);
-   std::cout << index_entries.size() << " Index entries were created." << std::endl;
+   write_included_documents();
+   boost::tiny_xml::writer os(outfile);
+   os.write(header + "\n");
+   os.write(*xml);
+   os.flush();
+   std::cout << count_index_entries() << " Index entries were created." << std::endl;
+   if(verbose)
+      print_match_cache_statistics();
 
    }
    catch(boost::exception& e)
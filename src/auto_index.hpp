@@ -17,26 +17,63 @@
 #define BOOST_FILESYSTEM_VERSION 3
 
 #include "tiny_xml.hpp"
+#include "interned_string.hpp"
+#include "lazy_regex.hpp"
+#include "text_kernels.hpp"
+#include <boost/cstdint.hpp>
 #include <boost/regex.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <fstream>
 #include <cctype>
+#include <ctime>
 #include <map>
 #include <set>
 #include <sstream>
 
 struct index_info
 {
-   std::string term;            // The term goes in the index entry
-   boost::regex search_text;    // What to search for when indexing the term.
-   boost::regex search_id;      // What id's this term may be indexed in.
-   std::string category;        // Index category (function, class, macro etc).
+   interned_string term;        // The term goes in the index entry
+   lazy_regex search_text;      // What to search for when indexing the term.
+   lazy_regex search_id;        // What id's this term may be indexed in.
+   interned_string category;    // Index category (function, class, macro etc).
 };
 inline bool operator < (const index_info& a, const index_info& b)
 {
    return (a.term != b.term) ? (a.term < b.term) : (a.category < b.category);
 }
+//
+// The set of terms to index, along with a hash index from each term's name to
+// its entries in every category, so that terms can be excluded in constant time.
+// Terms that have been excluded stay excluded from any headers scanned later on:
+//
+class index_term_set
+{
+public:
+   typedef std::set<index_info> set_type;
+   typedef set_type::iterator iterator;
+   typedef set_type::const_iterator const_iterator;
+
+   // Adds a term found by scanning a header, unless it's been excluded:
+   std::pair<iterator, bool> insert_scanned(const index_info& info);
+   // Adds a term given explicitly in a script, which is never excluded:
+   std::pair<iterator, bool> insert(const index_info& info);
+   // Removes every entry for the term, and prevents headers from adding it again:
+   void exclude(const interned_string& term);
+   bool is_excluded(const interned_string& term)const { return m_excluded.count(term) != 0; }
+
+   const_iterator begin()const { return m_terms.begin(); }
+   const_iterator end()const { return m_terms.end(); }
+   std::size_t size()const { return m_terms.size(); }
+   bool empty()const { return m_terms.empty(); }
+private:
+   set_type m_terms;
+   boost::unordered_map<interned_string, std::vector<iterator> > m_by_name;
+   boost::unordered_set<interned_string> m_excluded;
+};
 
 
 struct index_entry;
@@ -46,17 +83,22 @@ typedef std::set<index_entry_ptr> index_entry_set;
 
 struct index_entry
 {
-   std::string key;            // The index term.
-   std::string sort_key;       // upper case version of term used for sorting.
-   std::string id;             // The id of the block that we will link to.
-   std::string category;       // The category of this entry (function, class, macro etc).
+   interned_string key;        // The index term.
+   interned_string sort_key;   // upper case version of term used for sorting.
+   interned_string id;         // The id of the block that we will link to.
+   interned_string category;   // The category of this entry (function, class, macro etc).
    index_entry_set sub_keys;   // All our sub-keys.
    bool preferred;             // This entry is the preferred one for this key
 
    index_entry() : preferred(false) {}
-   index_entry(const std::string& k) : key(k), sort_key(k), preferred(false)  { boost::to_upper(sort_key); }
-   index_entry(const std::string& k, const std::string& i) : key(k), sort_key(k), id(i), preferred(false)  { boost::to_upper(sort_key); }
-   index_entry(const std::string& k, const std::string& i, const std::string& c) : key(k), sort_key(k), id(i), category(c), preferred(false)  { boost::to_upper(sort_key); }
+   explicit index_entry(const interned_string& k) : key(k), sort_key(make_sort_key(k)), preferred(false)  {}
+   index_entry(const interned_string& k, const interned_string& i) : key(k), sort_key(make_sort_key(k)), id(i), preferred(false)  {}
+   index_entry(const interned_string& k, const interned_string& i, const interned_string& c) : key(k), sort_key(make_sort_key(k)), id(i), category(c), preferred(false)  {}
+
+   static interned_string make_sort_key(const interned_string& k)
+   {
+      return interned_string(boost::to_upper_copy(k.str()));
+   }
 };
 
 
@@ -75,16 +117,32 @@ struct id_rewrite_rule
       : base_on_id(b), id(i), new_name(n) {}
 };
 
+//
+// The terms indexed so far in a block, with --no-duplicates: they're kept with
+// the scope of the element that gives the block its id, and go with it:
+//
+typedef boost::unordered_set<interned_string> found_term_set;
+
 struct node_id
 {
    const std::string* id;
    node_id* prev;
+   boost::shared_ptr<found_term_set> found_terms;
+
+   node_id(const std::string* i = 0, node_id* p = 0)
+      : id(i), prev(p) {}
 };
 
 struct title_info
 {
    std::string title;
    title_info* prev;
+   // The title as rewritten for the block with id rewritten_id, see get_rewritten_block_title:
+   std::string rewritten, rewritten_id;
+   bool have_rewritten;
+
+   title_info(const std::string& t = std::string(), title_info* p = 0)
+      : title(t), prev(p), have_rewritten(false) {}
 };
 
 struct file_scanner
@@ -100,11 +158,172 @@ inline bool operator < (const file_scanner & a, const file_scanner& b)
 
 typedef std::multiset<file_scanner> file_scanner_set_type;
 
+//
+// Identifies a file or directory independently of the path used to reach it,
+// so that one reached through more than one !scan-path root, or through a
+// symlink, is only scanned once:
+//
+struct file_identity
+{
+   boost::uintmax_t device, inode, size;
+   std::time_t modified;
+   std::string path;  // The canonical path, where there are no inode numbers.
+   bool regular;      // Not part of the identity.
+};
+bool operator < (const file_identity& a, const file_identity& b);
+bool get_file_identity(const std::string& file, file_identity& id);
+
+//
+// <?BoostAutoIndex IgnoreSection?> and <?BoostAutoIndex IgnoreBlock?> stop the
+// processing of the enclosing section or block at the point they occur.  A pre-pass
+// finds them, and records for each element whose processing stops early the last
+// of its children to process: either the processing instruction itself, or the
+// child that contains it:
+//
+enum ignore_kind
+{
+   ignore_nothing,
+   ignore_to_section,
+   ignore_to_block
+};
+typedef boost::unordered_map<const boost::tiny_xml::element*, const boost::tiny_xml::element*> ignore_map;
+
+ignore_kind find_ignored_content(const boost::tiny_xml::element_ptr& node, ignore_map& ignored);
+ignore_kind ignored_from(const boost::tiny_xml::element_ptr& child, ignore_map& ignored);
+bool ignore_stops_at(ignore_kind k, const std::string& name);
+void report_unenclosed_ignore(ignore_kind k);
+
+//
+// The terms found in each block of text, see find_matching_terms:
+//
+typedef std::vector<const index_info*> term_hits;
+typedef boost::unordered_map<std::string, term_hits> prematched_terms;
+
+void match_terms(const std::string& text, term_hits& hits);
+std::string get_header(std::istream & is);
+std::string get_consolidated_content(boost::tiny_xml::element_ptr node);
+void process_node(boost::tiny_xml::element_ptr node, node_id* prev, title_info* pt, boost::tiny_xml::element* container, bool in_title, bool seen);
+void process_nodes(boost::tiny_xml::element_ptr node);
+void process_nodes_pipelined(std::istream& is, const std::string& header, const std::string& outfile, std::size_t queue_size);
+void process_nodes_streamed(std::istream& is, const std::string& header, const std::string& outfile);
+bool can_contain_title(const char* name);
+bool can_contain_indexterm(const char* name);
+bool should_flatten_node(const char* name);
+bool is_section(const std::string& name);
+bool is_block(const std::string& name);
 void process_script(const std::string& script);
+bool is_compiled_script(const std::string& file);
+void save_compiled_script(const std::string& file);
+void load_compiled_script(const std::string& file);
+void save_index_entries(const index_entry_set& entries, const std::string& file);
+void load_index_entries(const std::string& file, index_entry_set& entries);
+void merge_index_entries(index_entry_set& into, const index_entry_set& from);
+void export_index_entries(const index_entry_set& entries, const std::string& file);
+void load_master_index(const std::vector<std::string>& args, index_entry_set& entries);
 void scan_dir(const std::string& dir, const std::string& mask, bool recurse);
 void scan_file(const std::string& file);
 void generate_indexes();
 const std::string* find_attr(boost::tiny_xml::element_ptr node, const char* name);
+void insert_indexterm(boost::tiny_xml::element* container, const std::string& primary, const std::string& secondary, const std::string& category, bool preferred);
+void insert_index_entries(const index_entry_ptr* first, const index_entry_ptr* last);
+
+//
+// Indexing a document in several processes with --shard=i/N, and combining
+// the results with --merge, see shards.cpp:
+//
+void begin_shard(const boost::tiny_xml::element_ptr& root, unsigned index, unsigned count);
+void begin_merge();
+bool indexes_document_root();
+bool indexes_top_level_child(std::size_t child, std::size_t children);
+void record_hit(const interned_string& id, const interned_string& term);
+void record_manual_entry();
+void record_indexterm(const boost::tiny_xml::element* container, const std::string& primary, const std::string& secondary, const std::string& type, bool preferred);
+void record_index_entries(const index_entry_ptr* first, const index_entry_ptr* last);
+void save_shard(const std::string& file);
+void merge_shards(const boost::tiny_xml::element_ptr& root, const std::vector<std::string>& files);
+
+//
+// Following xi:include elements with --xinclude, see xinclude.cpp:
+//
+void begin_includes(const boost::tiny_xml::element_ptr& root, const std::string& file, const std::string& output);
+boost::tiny_xml::element_ptr included_document(const boost::tiny_xml::element* include, const prematched_terms*& terms);
+void write_included_documents();
+void end_includes();
+
+//
+// Keeping within --memory-limit, see spill.cpp:
+//
+void set_memory_limit(boost::uintmax_t bytes);
+bool memory_limited();
+std::string create_spill_file();
+void remove_spill_file(const std::string& name);
+void note_index_entries_added(std::size_t count);
+void merge_spilled_index_entries();
+bool have_spilled_index_entries();
+std::size_t count_index_entries();
+
+//
+// Reads back the top level entries of an entry file one at a time, in order,
+// so that they needn't all be in memory at once, see entry_file.cpp:
+//
+class entry_file_reader : private boost::noncopyable
+{
+public:
+   explicit entry_file_reader(const std::string& file);
+   ~entry_file_reader();
+
+   bool at_end()const;
+   // The next top level entry, without its sub-keys:
+   const index_entry_ptr& front()const;
+   // Merges the next top level entry, with all its sub-keys, into entries:
+   void pop(index_entry_set& entries);
+   // Moves on without reading the sub-keys:
+   void skip();
+private:
+   struct impl;
+   boost::scoped_ptr<impl> m_impl;
+};
+
+//
+// Steps through the top level index entries in order, merging the spilled
+// runs with the entries still in memory as it goes, so that the whole set is
+// never in memory at once.  Each entry is just as merge_spilled_index_entries
+// would leave it:
+//
+class index_entry_merger : private boost::noncopyable
+{
+public:
+   index_entry_merger();
+
+   // Sets e to the next entry, with its sub-keys unless keys_only is true,
+   // and returns false once there are no more:
+   bool next(index_entry_ptr& e, bool keys_only = false);
+private:
+   std::vector<boost::shared_ptr<entry_file_reader> > m_runs;
+   index_entry_set::const_iterator m_memory;
+};
+
+//
+// XML that's been serialized but can't be written out yet, because something
+// may still have to go in front of it.  It's kept in memory, or if spill is
+// true, in a temporary file:
+//
+class deferred_output : private boost::noncopyable
+{
+public:
+   explicit deferred_output(bool spill);
+   ~deferred_output();
+
+   boost::tiny_xml::writer& out() { return *m_writer; }
+   bool empty();
+   void copy_to(boost::tiny_xml::writer& os);
+private:
+   std::stringstream m_memory;
+   std::fstream m_file;
+   std::string m_file_name;
+   std::iostream* m_stream;
+   boost::scoped_ptr<boost::tiny_xml::writer> m_writer;
+};
 
 extern file_scanner_set_type file_scanner_set;
 
@@ -122,8 +341,7 @@ inline void add_file_scanner(const std::string& type, const std::string& scanner
    file_scanner_set.insert(s);
 }
 
-extern std::set<index_info> index_terms;
-extern std::set<std::pair<std::string, std::string> > found_terms;
+extern index_term_set index_terms;
 extern bool no_duplicates;
 extern bool verbose;
 extern index_entry_set index_entries;
@@ -133,5 +351,7 @@ extern bool internal_indexes;
 extern std::string prefix;
 extern std::string internal_index_type;
 extern boost::regex debug;
+extern ignore_map ignored_content;
+extern bool sharding;
 
 #endif
@@ -0,0 +1,67 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BOOST_AUTO_INDEX_BOUNDED_QUEUE_HPP
+#define BOOST_AUTO_INDEX_BOUNDED_QUEUE_HPP
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+
+//
+// A first-in first-out queue for handing work from one thread to another,
+// push blocks while the queue is full, and pop blocks while it's empty.
+// Once closed, pushes are refused and pop drains whatever is left:
+//
+template <class T>
+class bounded_queue : private boost::noncopyable
+{
+public:
+   explicit bounded_queue(std::size_t capacity) : m_capacity(capacity ? capacity : 1), m_closed(false) {}
+
+   // Returns false if the queue was closed, in which case t is discarded.
+   bool push(const T& t)
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while((m_items.size() >= m_capacity) && !m_closed)
+         m_not_full.wait(lock);
+      if(m_closed)
+         return false;
+      m_items.push_back(t);
+      m_not_empty.notify_one();
+      return true;
+   }
+   // Returns false if the queue is closed and empty.
+   bool pop(T& t)
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while(m_items.empty() && !m_closed)
+         m_not_empty.wait(lock);
+      if(m_items.empty())
+         return false;
+      t = m_items.front();
+      m_items.pop_front();
+      m_not_full.notify_one();
+      return true;
+   }
+   void close()
+   {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_closed = true;
+      m_not_full.notify_all();
+      m_not_empty.notify_all();
+   }
+private:
+   boost::mutex m_mutex;
+   boost::condition_variable m_not_full, m_not_empty;
+   std::deque<T> m_items;
+   std::size_t m_capacity;
+   bool m_closed;
+};
+
+#endif
@@ -0,0 +1,151 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Compiled scripts: the terms, rewrite rules and debug setting that result from
+// processing a script (including any header scanning it asks for) saved
+// in a binary form that can be loaded again without re-running any of it.
+//
+// The layout is a fixed header followed by records, all integers are 32-bit
+// in the byte order of the machine that wrote the file:
+//
+//    char[8]   magic "AIDXPACK"
+//    uint32    byte order check, 0x01020304
+//    uint32    version
+//    uint32    number of terms
+//    uint32    number of rewrite rules
+//    string    debug regex ("" for none)
+//    terms:    string term, string category,
+//              string search_text, uint32 search_text flags,
+//              string search_id, uint32 search_id flags
+//    rules:    uint32 base_on_id, string regex, string new_name
+//
+// where each string is a uint32 length followed by that many bytes.
+//
+
+#include "auto_index.hpp"
+#include "pack_io.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstring>
+
+namespace
+{
+   const char pack_magic[8] = { 'A', 'I', 'D', 'X', 'P', 'A', 'C', 'K' };
+   const boost::uint32_t pack_byte_order = 0x01020304u;
+   const boost::uint32_t pack_version = 1;
+
+   void write_regex(std::ostream& os, const lazy_regex& e)
+   {
+      write_string(os, e.str());
+      write_u32(os, e.empty() ? 0 : static_cast<boost::uint32_t>(e.flags()));
+   }
+   lazy_regex read_regex(pack_reader& reader)
+   {
+      std::string s = reader.read_string();
+      boost::uint32_t flags = reader.read_u32();
+      if(s.empty())
+         return lazy_regex();
+      return lazy_regex(s, static_cast<boost::regex::flag_type>(flags));
+   }
+}
+
+bool is_compiled_script(const std::string& file)
+{
+   std::ifstream is(file.c_str(), std::ios_base::binary);
+   char magic[sizeof(pack_magic)];
+   return is.read(magic, sizeof(magic)) && (std::memcmp(magic, pack_magic, sizeof(magic)) == 0);
+}
+
+void save_compiled_script(const std::string& file)
+{
+   //
+   // Every expression is compiled before anything is written, so that no
+   // compiled script is created from a script with an invalid one:
+   //
+   for(index_term_set::const_iterator i = index_terms.begin(); i != index_terms.end(); ++i)
+   {
+      try
+      {
+         if(!i->search_text.empty())
+            i->search_text.check();
+         if(!i->search_id.empty())
+            i->search_id.check();
+      }
+      catch(const boost::regex_error& e)
+      {
+         throw std::runtime_error("Unable to compile the regular expressions for index term \"" + i->term.str() + "\": " + e.what());
+      }
+   }
+   std::ofstream os(file.c_str(), std::ios_base::binary);
+   if(!os.good())
+      throw std::runtime_error("Could not create compiled script file: " + file);
+   os.write(pack_magic, sizeof(pack_magic));
+   write_u32(os, pack_byte_order);
+   write_u32(os, pack_version);
+   write_u32(os, static_cast<boost::uint32_t>(index_terms.size()));
+   write_u32(os, static_cast<boost::uint32_t>(id_rewrite_list.size()));
+   write_string(os, debug.empty() ? std::string() : debug.str());
+   for(index_term_set::const_iterator i = index_terms.begin(); i != index_terms.end(); ++i)
+   {
+      write_string(os, i->term.str());
+      write_string(os, i->category.str());
+      write_regex(os, i->search_text);
+      write_regex(os, i->search_id);
+   }
+   for(std::list<id_rewrite_rule>::const_iterator i = id_rewrite_list.begin(); i != id_rewrite_list.end(); ++i)
+   {
+      write_u32(os, i->base_on_id ? 1 : 0);
+      write_string(os, i->id.str());
+      write_string(os, i->new_name);
+   }
+   if(!os.good())
+      throw std::runtime_error("Error writing compiled script file: " + file);
+   if(verbose)
+      std::cout << "Wrote " << index_terms.size() << " terms and " << id_rewrite_list.size() << " rewrite rules to " << file << std::endl;
+}
+
+void load_compiled_script(const std::string& file)
+{
+   if(verbose)
+      std::cout << "Loading compiled script " << file << std::endl;
+   if(boost::filesystem::file_size(file) == 0)
+      throw std::runtime_error("Compiled script file is truncated or corrupt: " + file);
+   boost::interprocess::file_mapping mapping(file.c_str(), boost::interprocess::read_only);
+   boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+   pack_reader reader(static_cast<const char*>(region.get_address()), region.get_size(), file, "Compiled script file is truncated or corrupt: ");
+
+   if(std::memcmp(reader.read_bytes(sizeof(pack_magic)), pack_magic, sizeof(pack_magic)))
+      throw std::runtime_error("Not a compiled script file: " + file);
+   if(reader.read_u32() != pack_byte_order)
+      throw std::runtime_error("Compiled script file was created on a machine with a different byte order: " + file);
+   if(reader.read_u32() != pack_version)
+      throw std::runtime_error("Compiled script file was created by an incompatible version of AutoIndex: " + file);
+   boost::uint32_t term_count = reader.read_u32();
+   boost::uint32_t rule_count = reader.read_u32();
+   std::string d = reader.read_string();
+   if(d.size())
+      debug = d;
+   for(boost::uint32_t i = 0; i < term_count; ++i)
+   {
+      index_info info;
+      info.term = interned_string(reader.read_string());
+      info.category = interned_string(reader.read_string());
+      info.search_text = read_regex(reader);
+      info.search_id = read_regex(reader);
+      index_terms.insert(info);
+   }
+   for(boost::uint32_t i = 0; i < rule_count; ++i)
+   {
+      bool base_on_id = reader.read_u32() != 0;
+      std::string e = reader.read_string();
+      std::string new_name = reader.read_string();
+      id_rewrite_list.push_back(id_rewrite_rule(e, new_name, base_on_id));
+   }
+   if(!reader.at_end())
+      throw std::runtime_error("Compiled script file is truncated or corrupt: " + file);
+}
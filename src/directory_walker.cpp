@@ -0,0 +1,308 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Directory scanning: worker threads list the directories below a !scan-path
+// root while this thread scans the files found so far, so that scanning
+// starts before the enumeration is finished.
+//
+// Which header a term is first found in matters, so the files are still scanned
+// in exactly the order a serial depth first walk would visit them: each
+// directory's listing keeps the entries in directory order, and we wait for
+// the listing of each subdirectory when we reach it (or list it ourselves if
+// no worker has got to it yet).  Directories are identified by device and inode
+// (or canonical path), so that symlinked or overlapping trees are only listed and
+// walked once: a directory reached by more than one path shares one listing, and
+// which of those paths it's walked through is settled by this thread as the walk
+// reaches each of them, so it's always the first in depth first order.
+//
+
+#include "auto_index.hpp"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <deque>
+
+namespace
+{
+   //
+   // Most masks are of the form ".*\.hpp", which only need a test of the end of
+   // the file name rather than running the expression:
+   //
+   class file_mask
+   {
+   public:
+      file_mask(const std::string& mask) : m_regex(mask), m_simple(get_suffix(mask, m_suffix)) {}
+
+      bool matches(const std::string& name)const
+      {
+         if(m_simple && (name.find('\n') == std::string::npos))
+            return (name.size() >= m_suffix.size()) && (name.compare(name.size() - m_suffix.size(), m_suffix.size(), m_suffix) == 0);
+         return regex_match(name, m_regex);
+      }
+   private:
+      static bool get_suffix(const std::string& mask, std::string& suffix)
+      {
+         if(mask.compare(0, 2, ".*") != 0)
+            return false;
+         for(std::string::size_type i = 2; i < mask.size(); ++i)
+         {
+            char c = mask[i];
+            if((c == '\\') && (i + 1 < mask.size()) && std::ispunct(static_cast<unsigned char>(mask[i + 1])))
+               c = mask[++i];
+            else if(!std::isalnum(static_cast<unsigned char>(c)) && (c != '_') && (c != '-'))
+               return false;
+            suffix.append(1, c);
+         }
+         return true;
+      }
+
+      boost::regex m_regex;
+      std::string m_suffix;
+      bool m_simple;
+   };
+
+   struct dir_listing;
+
+   //
+   // An entry is either a file to scan, or a subdirectory to walk, its path is
+   // made up as the walk reaches it:
+   //
+   struct dir_entry
+   {
+      std::string name;
+      boost::shared_ptr<dir_listing> subdir;
+   };
+
+   struct dir_listing
+   {
+      std::string path;   // Whichever path it was first found through.
+      bool claimed;     // Someone is listing it.
+      bool ready;       // They've finished.
+      std::vector<dir_entry> entries;
+      boost::exception_ptr error;
+
+      dir_listing(const std::string& p) : path(p), claimed(false), ready(false) {}
+   };
+
+   // Where the walk has got to in one directory:
+   struct walk_frame
+   {
+      boost::shared_ptr<dir_listing> listing;
+      boost::filesystem::path path;
+      std::size_t pos;
+   };
+
+   class directory_walker
+   {
+   public:
+      directory_walker(const std::string& mask, bool recurse) : m_mask(mask), m_recurse(recurse), m_stop(false) {}
+
+      void run(const std::string& dir);
+      void work();
+      void stop();
+   private:
+      void list(dir_listing& d);
+      void wait_for(dir_listing& d);
+
+      file_mask m_mask;
+      bool m_recurse;
+      boost::mutex m_mutex;
+      boost::condition_variable m_cond;
+      std::deque<boost::shared_ptr<dir_listing> > m_queue;
+      std::map<file_identity, boost::shared_ptr<dir_listing> > m_listings;
+      std::set<const dir_listing*> m_walked;  // Only used by the thread in run().
+      bool m_stop;
+   };
+
+   struct walker_thread
+   {
+      directory_walker* walker;
+      void operator()()const { walker->work(); }
+   };
+
+   //
+   // Makes sure the workers have finished before the walker goes out of scope,
+   // however we leave:
+   //
+   struct walker_guard
+   {
+      directory_walker& walker;
+      boost::thread_group& workers;
+      ~walker_guard()
+      {
+         walker.stop();
+         workers.join_all();
+      }
+   };
+
+   void directory_walker::list(dir_listing& d)
+   {
+      using namespace boost::filesystem;
+      std::vector<dir_entry> entries;
+      std::vector<boost::shared_ptr<dir_listing> > subdirs;
+      boost::exception_ptr error;
+      try
+      {
+         for(directory_iterator i(d.path), j; i != j; ++i)
+         {
+            dir_entry e;
+            e.name = i->path().filename().string();
+            if(!m_mask.matches(e.name))
+            {
+               if(!m_recurse || !is_directory(i->status()))
+                  continue;
+               std::string sub_path = i->path().string();
+               file_identity id;
+               if(get_file_identity(sub_path, id))
+               {
+                  id.size = 0;
+                  id.modified = 0;
+                  boost::mutex::scoped_lock l(m_mutex);
+                  boost::shared_ptr<dir_listing>& listing = m_listings[id];
+                  if(!listing)
+                  {
+                     listing.reset(new dir_listing(sub_path));
+                     subdirs.push_back(listing);
+                  }
+                  // Otherwise it's been found through another path, and is listed already or queued to be:
+                  e.subdir = listing;
+               }
+               else
+               {
+                  e.subdir.reset(new dir_listing(sub_path));
+                  subdirs.push_back(e.subdir);
+               }
+            }
+            entries.push_back(e);
+         }
+      }
+      catch(const filesystem_error& e)
+      {
+         error = boost::copy_exception(e);
+      }
+      catch(...)
+      {
+         error = boost::current_exception();
+      }
+      boost::mutex::scoped_lock l(m_mutex);
+      d.entries.swap(entries);
+      d.error = error;
+      d.ready = true;
+      m_queue.insert(m_queue.end(), subdirs.begin(), subdirs.end());
+      m_cond.notify_all();
+   }
+
+   void directory_walker::work()
+   {
+      boost::mutex::scoped_lock l(m_mutex);
+      while(true)
+      {
+         while(!m_stop && m_queue.empty())
+            m_cond.wait(l);
+         if(m_stop)
+            return;
+         boost::shared_ptr<dir_listing> d = m_queue.front();
+         m_queue.pop_front();
+         if(d->claimed)
+            continue;
+         d->claimed = true;
+         l.unlock();
+         list(*d);
+         l.lock();
+      }
+   }
+
+   void directory_walker::wait_for(dir_listing& d)
+   {
+      boost::mutex::scoped_lock l(m_mutex);
+      if(!d.claimed)
+      {
+         // Nobody has started on it yet, so it's quicker to do it ourselves:
+         d.claimed = true;
+         l.unlock();
+         list(d);
+         l.lock();
+      }
+      while(!d.ready)
+         m_cond.wait(l);
+      if(d.error)
+         boost::rethrow_exception(d.error);
+   }
+
+   void directory_walker::stop()
+   {
+      boost::mutex::scoped_lock l(m_mutex);
+      m_stop = true;
+      m_queue.clear();
+      m_cond.notify_all();
+   }
+
+   void directory_walker::run(const std::string& dir)
+   {
+      boost::shared_ptr<dir_listing> root(new dir_listing(dir));
+      file_identity id;
+      if(get_file_identity(dir, id))
+      {
+         id.size = 0;
+         id.modified = 0;
+         m_listings[id] = root;
+      }
+      m_walked.insert(root.get());
+      boost::thread_group workers;
+      walker_guard guard = { *this, workers };
+      if(m_recurse)
+      {
+         unsigned n = boost::thread::hardware_concurrency();
+         n = n < 1 ? 1 : n > 8 ? 8 : n;
+         for(unsigned i = 0; i < n; ++i)
+         {
+            walker_thread t = { this };
+            workers.create_thread(t);
+         }
+      }
+      //
+      // Depth first over the listings, scanning the files as we go, a directory
+      // that's been walked already through another path is skipped:
+      //
+      std::vector<walk_frame> stack;
+      walk_frame f = { root, dir, 0 };
+      stack.push_back(f);
+      wait_for(*root);
+      while(!stack.empty())
+      {
+         walk_frame& top = stack.back();
+         if(top.pos == top.listing->entries.size())
+         {
+            stack.pop_back();
+            continue;
+         }
+         const dir_entry& e = top.listing->entries[top.pos++];
+         std::string path = (top.path / e.name).string();
+         if(e.subdir)
+         {
+            if(!m_walked.insert(e.subdir.get()).second)
+               continue;
+            wait_for(*e.subdir);
+            walk_frame sub = { e.subdir, path, 0 };
+            stack.push_back(sub);
+         }
+         else
+            scan_file(path);
+      }
+   }
+}
+//
+// Scan a whole directory for files to search:
+//
+void scan_dir(const std::string& dir, const std::string& mask, bool recurse)
+{
+   directory_walker walker(mask, recurse);
+   walker.run(dir);
+}
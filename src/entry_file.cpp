@@ -0,0 +1,457 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Entry files: an index_entry_set saved in a binary form that can be mapped
+// into memory and merged into another run's index entries, without parsing
+// or indexing the document they came from again.
+//
+// All integers are 32-bit in the byte order of the machine that wrote the file,
+// and the entries are laid out breadth first, so that the sub-keys of each
+// entry are a contiguous range of the entries that follow it:
+//
+//    char[8]   magic "AIDXENTS"
+//    uint32    byte order check, 0x01020304
+//    uint32    version
+//    uint32    number of strings
+//    uint32    total size of the strings
+//    uint32    number of entries
+//    uint32    number of top level entries, these come first
+//    entries:  uint32 key, uint32 sort_key, uint32 id, uint32 category,
+//              uint32 flags (1 = preferred),
+//              uint32 first sub-key, uint32 number of sub-keys
+//    uint32    offset of each string in the string data, plus one for the end
+//    char[]    the string data
+//
+// where each string is stored once, and is referred to by its number,
+// string 0 is always the empty string.
+//
+
+#include "auto_index.hpp"
+#include "pack_io.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/exception_ptr.hpp>
+
+namespace
+{
+   const char entry_magic[8] = { 'A', 'I', 'D', 'X', 'E', 'N', 'T', 'S' };
+   const boost::uint32_t entry_byte_order = 0x01020304u;
+   const boost::uint32_t entry_version = 1;
+   const std::size_t header_size = sizeof(entry_magic) + 6 * sizeof(boost::uint32_t);
+   const std::size_t record_size = 7 * sizeof(boost::uint32_t);
+   const boost::uint32_t flag_preferred = 1;
+
+   //
+   // Builds the table of distinct strings:
+   //
+   class string_table
+   {
+   public:
+      string_table() : m_size(0) { add(std::string()); }
+      boost::uint32_t add(const std::string& s)
+      {
+         boost::unordered_map<std::string, boost::uint32_t>::const_iterator pos = m_index.find(s);
+         if(pos != m_index.end())
+            return pos->second;
+         boost::uint32_t n = static_cast<boost::uint32_t>(m_strings.size());
+         m_index[s] = n;
+         m_strings.push_back(s);
+         m_size += s.size();
+         return n;
+      }
+      const std::vector<std::string>& strings()const { return m_strings; }
+      std::size_t size()const { return m_size; }
+   private:
+      boost::unordered_map<std::string, boost::uint32_t> m_index;
+      std::vector<std::string> m_strings;
+      std::size_t m_size;
+   };
+
+   //
+   // Random access to the mapped file, checking everything against its size:
+   //
+   class entry_file_view
+   {
+   public:
+      entry_file_view(const char* p, std::size_t n, const std::string& file) : m_data(p), m_size(n), m_file(file)
+      {
+         if((n < header_size) || std::memcmp(p, entry_magic, sizeof(entry_magic)))
+            throw std::runtime_error("Not an index entry file: " + file);
+         if(u32(sizeof(entry_magic)) != entry_byte_order)
+            throw std::runtime_error("Index entry file was created on a machine with a different byte order: " + file);
+         if(u32(sizeof(entry_magic) + 4) != entry_version)
+            throw std::runtime_error("Index entry file was created by an incompatible version of AutoIndex: " + file);
+         m_string_count = u32(sizeof(entry_magic) + 8);
+         boost::uint32_t string_bytes = u32(sizeof(entry_magic) + 12);
+         m_entry_count = u32(sizeof(entry_magic) + 16);
+         m_root_count = u32(sizeof(entry_magic) + 20);
+         m_offsets = header_size + static_cast<boost::uintmax_t>(m_entry_count) * record_size;
+         m_strings = m_offsets + (static_cast<boost::uintmax_t>(m_string_count) + 1) * sizeof(boost::uint32_t);
+         if((m_string_count == 0) || (m_root_count > m_entry_count) || (m_strings + string_bytes != n))
+            corrupt();
+      }
+      boost::uint32_t entry_count()const { return m_entry_count; }
+      boost::uint32_t root_count()const { return m_root_count; }
+      boost::uint32_t field(boost::uint32_t entry, unsigned f)const
+      {
+         return u32(header_size + static_cast<std::size_t>(entry) * record_size + f * sizeof(boost::uint32_t));
+      }
+      interned_string string(boost::uint32_t entry, unsigned f)const
+      {
+         boost::uint32_t s = field(entry, f);
+         if(s >= m_string_count)
+            corrupt();
+         boost::uint32_t first = u32(static_cast<std::size_t>(m_offsets + s * sizeof(boost::uint32_t)));
+         boost::uint32_t last = u32(static_cast<std::size_t>(m_offsets + (s + 1) * sizeof(boost::uint32_t)));
+         if((first > last) || (last > m_size - m_strings))
+            corrupt();
+         return interned_string(std::string(m_data + m_strings + first, m_data + m_strings + last));
+      }
+      void corrupt()const
+      {
+         throw std::runtime_error("Index entry file is truncated or corrupt: " + m_file);
+      }
+   private:
+      boost::uint32_t u32(std::size_t pos)const
+      {
+         boost::uint32_t v;
+         if(pos + sizeof(v) > m_size)
+            corrupt();
+         std::memcpy(&v, m_data + pos, sizeof(v));
+         return v;
+      }
+      const char* m_data;
+      std::size_t m_size;
+      std::string m_file;
+      boost::uint32_t m_string_count, m_entry_count, m_root_count;
+      boost::uintmax_t m_offsets, m_strings;
+   };
+   //
+   // Puts every link in entries into namespace ns:
+   //
+   void namespace_ids(index_entry_set& entries, const std::string& ns)
+   {
+      std::vector<index_entry_set*> stack(1, &entries);
+      while(!stack.empty())
+      {
+         index_entry_set* s = stack.back();
+         stack.pop_back();
+         for(index_entry_set::iterator i = s->begin(); i != s->end(); ++i)
+         {
+            if((*i)->id.size())
+               (*i)->id = interned_string(ns + "." + (*i)->id.str());
+            stack.push_back(&(*i)->sub_keys);
+         }
+      }
+   }
+   //
+   // Loads one document's entries for the master index, the argument is the
+   // file name, optionally preceded by "namespace=":
+   //
+   void load_master_entries(const std::string& arg, index_entry_set& entries)
+   {
+      std::string::size_type pos = arg.find('=');
+      load_index_entries(pos == std::string::npos ? arg : arg.substr(pos + 1), entries);
+      if((pos != std::string::npos) && pos)
+         namespace_ids(entries, arg.substr(0, pos));
+   }
+   //
+   // Workers for the master index, a loader takes every stride'th document
+   // starting from first, and a merger combines two of the sets:
+   //
+   struct master_loader
+   {
+      const std::vector<std::string>* args;
+      std::vector<index_entry_set>* sets;
+      std::vector<boost::exception_ptr>* errors;
+      std::size_t first, stride;
+
+      void operator()()const
+      {
+         for(std::size_t i = first; i < args->size(); i += stride)
+         {
+            try
+            {
+               load_master_entries((*args)[i], (*sets)[i]);
+            }
+            catch(const std::runtime_error& e)
+            {
+               (*errors)[i] = boost::copy_exception(e);
+            }
+            catch(...)
+            {
+               (*errors)[i] = boost::current_exception();
+            }
+         }
+      }
+   };
+   struct master_merger
+   {
+      index_entry_set* into;
+      index_entry_set* from;
+
+      void operator()()const
+      {
+         merge_index_entries(*into, *from);
+         from->clear();
+      }
+   };
+   enum
+   {
+      field_key,
+      field_sort_key,
+      field_id,
+      field_category,
+      field_flags,
+      field_first_child,
+      field_child_count
+   };
+   //
+   // Checks that the sub-key ranges really do tile the entries breadth first,
+   // so that they form a tree:
+   //
+   void check_entry_tree(const entry_file_view& view)
+   {
+      boost::uintmax_t next = view.root_count();
+      for(boost::uint32_t n = 0; n < view.entry_count(); ++n)
+      {
+         if(view.field(n, field_first_child) != next)
+            view.corrupt();
+         next += view.field(n, field_child_count);
+      }
+      if(next != view.entry_count())
+         view.corrupt();
+   }
+   //
+   // Creates entry n, without its sub-keys:
+   //
+   index_entry_ptr read_entry(const entry_file_view& view, boost::uint32_t n)
+   {
+      index_entry_ptr e(new index_entry());
+      e->key = view.string(n, field_key);
+      e->sort_key = view.string(n, field_sort_key);
+      e->id = view.string(n, field_id);
+      e->category = view.string(n, field_category);
+      e->preferred = (view.field(n, field_flags) & flag_preferred) != 0;
+      return e;
+   }
+   //
+   // Merges entry root and its sub-keys into entries, an entry that's already
+   // there keeps its id and flags, but gains any sub-keys it didn't have:
+   //
+   void load_entry_tree(const entry_file_view& view, boost::uint32_t root, index_entry_set& entries)
+   {
+      std::vector<std::pair<boost::uint32_t, index_entry_set*> > stack(1, std::make_pair(root, &entries));
+      while(!stack.empty())
+      {
+         boost::uint32_t n = stack.back().first;
+         index_entry_set* parent = stack.back().second;
+         stack.pop_back();
+         index_entry_set* children = &(*parent->insert(read_entry(view, n)).first)->sub_keys;
+         boost::uint32_t first = view.field(n, field_first_child);
+         boost::uint32_t count = view.field(n, field_child_count);
+         for(boost::uint32_t i = count; i > 0; --i)
+            stack.push_back(std::make_pair(first + i - 1, children));
+      }
+   }
+}
+
+void save_index_entries(const index_entry_set& entries, const std::string& file)
+{
+   //
+   // Lay the entries out breadth first, so that each one's sub-keys are contiguous:
+   //
+   std::vector<const index_entry*> order;
+   std::vector<boost::uint32_t> first_child;
+   for(index_entry_set::const_iterator i = entries.begin(); i != entries.end(); ++i)
+      order.push_back(i->get());
+   for(std::size_t n = 0; n < order.size(); ++n)
+   {
+      first_child.push_back(static_cast<boost::uint32_t>(order.size()));
+      for(index_entry_set::const_iterator i = order[n]->sub_keys.begin(); i != order[n]->sub_keys.end(); ++i)
+         order.push_back(i->get());
+   }
+   string_table strings;
+   std::vector<boost::uint32_t> records;
+   records.reserve(order.size() * 7);
+   for(std::size_t n = 0; n < order.size(); ++n)
+   {
+      const index_entry& e = *order[n];
+      records.push_back(strings.add(e.key.str()));
+      records.push_back(strings.add(e.sort_key.str()));
+      records.push_back(strings.add(e.id.str()));
+      records.push_back(strings.add(e.category.str()));
+      records.push_back(e.preferred ? flag_preferred : 0);
+      records.push_back(first_child[n]);
+      records.push_back(static_cast<boost::uint32_t>(e.sub_keys.size()));
+   }
+
+   std::ofstream os(file.c_str(), std::ios_base::binary);
+   if(!os.good())
+      throw std::runtime_error("Could not create index entry file: " + file);
+   os.write(entry_magic, sizeof(entry_magic));
+   write_u32(os, entry_byte_order);
+   write_u32(os, entry_version);
+   write_u32(os, static_cast<boost::uint32_t>(strings.strings().size()));
+   write_u32(os, static_cast<boost::uint32_t>(strings.size()));
+   write_u32(os, static_cast<boost::uint32_t>(order.size()));
+   write_u32(os, static_cast<boost::uint32_t>(entries.size()));
+   if(records.size())
+      os.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(boost::uint32_t));
+   boost::uint32_t offset = 0;
+   for(std::vector<std::string>::const_iterator i = strings.strings().begin(); i != strings.strings().end(); ++i)
+   {
+      write_u32(os, offset);
+      offset += static_cast<boost::uint32_t>(i->size());
+   }
+   write_u32(os, offset);
+   for(std::vector<std::string>::const_iterator i = strings.strings().begin(); i != strings.strings().end(); ++i)
+      os.write(i->data(), i->size());
+   if(!os.good())
+      throw std::runtime_error("Error writing index entry file: " + file);
+   if(verbose)
+      std::cout << "Wrote " << order.size() << " index entries to " << file << std::endl;
+}
+
+void load_index_entries(const std::string& file, index_entry_set& entries)
+{
+   if(verbose)
+      std::cout << "Loading index entries from " << file << std::endl;
+   if(!boost::filesystem::exists(file) || (boost::filesystem::file_size(file) == 0))
+      throw std::runtime_error("Not an index entry file: " + file);
+   boost::interprocess::file_mapping mapping(file.c_str(), boost::interprocess::read_only);
+   boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+   entry_file_view view(static_cast<const char*>(region.get_address()), region.get_size(), file);
+   check_entry_tree(view);
+   for(boost::uint32_t n = 0; n < view.root_count(); ++n)
+      load_entry_tree(view, n, entries);
+}
+
+struct entry_file_reader::impl
+{
+   boost::interprocess::file_mapping mapping;
+   boost::interprocess::mapped_region region;
+   boost::scoped_ptr<entry_file_view> view;
+   boost::uint32_t next;
+   index_entry_ptr front;
+
+   explicit impl(const std::string& file) : next(0)
+   {
+      if(!boost::filesystem::exists(file) || (boost::filesystem::file_size(file) == 0))
+         throw std::runtime_error("Not an index entry file: " + file);
+      boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_only).swap(mapping);
+      boost::interprocess::mapped_region(mapping, boost::interprocess::read_only).swap(region);
+      view.reset(new entry_file_view(static_cast<const char*>(region.get_address()), region.get_size(), file));
+      check_entry_tree(*view);
+      read_front();
+   }
+   void read_front()
+   {
+      if(next < view->root_count())
+         front = read_entry(*view, next);
+      else
+         front.reset();
+   }
+};
+
+entry_file_reader::entry_file_reader(const std::string& file) : m_impl(new impl(file)) {}
+
+entry_file_reader::~entry_file_reader() {}
+
+bool entry_file_reader::at_end()const
+{
+   return !m_impl->front;
+}
+
+const index_entry_ptr& entry_file_reader::front()const
+{
+   return m_impl->front;
+}
+
+void entry_file_reader::pop(index_entry_set& entries)
+{
+   load_entry_tree(*m_impl->view, m_impl->next, entries);
+   skip();
+}
+
+void entry_file_reader::skip()
+{
+   ++m_impl->next;
+   m_impl->read_front();
+}
+
+void merge_index_entries(index_entry_set& into, const index_entry_set& from)
+{
+   typedef std::pair<index_entry_set*, const index_entry_set*> merge_frame;
+   std::vector<merge_frame> stack(1, merge_frame(&into, &from));
+   while(!stack.empty())
+   {
+      merge_frame f = stack.back();
+      stack.pop_back();
+      for(index_entry_set::const_iterator i = f.second->begin(); i != f.second->end(); ++i)
+      {
+         std::pair<index_entry_set::iterator, bool> pos = f.first->insert(*i);
+         if(!pos.second && (*pos.first != *i))
+            stack.push_back(merge_frame(&(*pos.first)->sub_keys, &(*i)->sub_keys));
+      }
+   }
+}
+
+void load_master_index(const std::vector<std::string>& args, index_entry_set& entries)
+{
+   if(args.empty())
+      return;
+   std::size_t thread_count = (std::min)(args.size(), static_cast<std::size_t>(boost::thread::hardware_concurrency()));
+   std::vector<index_entry_set> sets(args.size());
+   std::vector<boost::exception_ptr> errors(args.size());
+   //
+   // Load each document's entries in parallel:
+   //
+   if(thread_count < 2)
+   {
+      for(std::size_t i = 0; i < args.size(); ++i)
+         load_master_entries(args[i], sets[i]);
+   }
+   else
+   {
+      boost::thread_group threads;
+      for(std::size_t i = 0; i < thread_count; ++i)
+      {
+         master_loader l = { &args, &sets, &errors, i, thread_count };
+         threads.create_thread(l);
+      }
+      threads.join_all();
+      for(std::size_t i = 0; i < errors.size(); ++i)
+      {
+         if(errors[i])
+            boost::rethrow_exception(errors[i]);
+      }
+   }
+   //
+   // Then merge them pairwise, each round halving the number of sets, and
+   // each merge keeping the entries of the earlier document where they clash,
+   // so that the result is the same as merging them one at a time in order:
+   //
+   for(std::size_t step = 1; step < sets.size(); step *= 2)
+   {
+      boost::thread_group threads;
+      for(std::size_t i = 0; i + step < sets.size(); i += 2 * step)
+      {
+         master_merger m = { &sets[i], &sets[i + step] };
+         if(thread_count < 2)
+            m();
+         else
+            threads.create_thread(m);
+      }
+      threads.join_all();
+   }
+   merge_index_entries(entries, sets[0]);
+   if(verbose)
+      std::cout << "Merged the index entries of " << args.size() << " documents" << std::endl;
+}
@@ -6,9 +6,40 @@
 // or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "auto_index.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#ifdef BOOST_HAS_UNISTD_H
+#include <sys/stat.h>
+#endif
 
 bool need_defaults = true;
 
+std::pair<index_term_set::iterator, bool> index_term_set::insert_scanned(const index_info& info)
+{
+   if(is_excluded(info.term))
+      return std::make_pair(m_terms.end(), false);
+   return insert(info);
+}
+
+std::pair<index_term_set::iterator, bool> index_term_set::insert(const index_info& info)
+{
+   std::pair<iterator, bool> result = m_terms.insert(info);
+   if(result.second)
+      m_by_name[info.term].push_back(result.first);
+   return result;
+}
+
+void index_term_set::exclude(const interned_string& term)
+{
+   m_excluded.insert(term);
+   boost::unordered_map<interned_string, std::vector<iterator> >::iterator pos = m_by_name.find(term);
+   if(pos == m_by_name.end())
+      return;
+   for(std::vector<iterator>::const_iterator i = pos->second.begin(); i != pos->second.end(); ++i)
+      m_terms.erase(*i);
+   m_by_name.erase(pos);
+}
+
 void install_default_scanners()
 {
    need_defaults = false;
@@ -90,49 +121,54 @@ void install_default_scanners()
    }
 }
 
-//
-// Helper to dump file contents into a std::string:
-//
-void load_file(std::string& s, std::istream& is)
+bool operator < (const file_identity& a, const file_identity& b)
 {
-   s.erase();
-   if(is.bad()) return;
-   s.reserve(is.rdbuf()->in_avail());
-   char c;
-   while(is.get(c))
-   {
-      if(s.capacity() == s.size())
-         s.reserve(s.capacity() * 3);
-      s.append(1, c);
-   }
+   if(a.device != b.device)
+      return a.device < b.device;
+   if(a.inode != b.inode)
+      return a.inode < b.inode;
+   if(a.size != b.size)
+      return a.size < b.size;
+   if(a.modified != b.modified)
+      return a.modified < b.modified;
+   return a.path < b.path;
 }
-//
-// Helper to convert string from external source into valid XML:
-//
-std::string escape_to_xml(const std::string& in)
+
+bool get_file_identity(const std::string& file, file_identity& id)
 {
-   std::string result;
-   for(std::string::size_type i = 0; i < in.size(); ++i)
-   {
-      switch(in[i])
-      {
-      case '&':
-         result.append("&amp;");
-         break;
-      case '<':
-         result.append("&lt;");
-         break;
-      case '>':
-         result.append("&gt;");
-         break;
-      case '"':
-         result.append("&quot;");
-         break;
-      default:
-         result.append(1, in[i]);
-      }
-   }
-   return result;
+#ifdef BOOST_HAS_UNISTD_H
+   struct stat st;
+   if(::stat(file.c_str(), &st) != 0)
+      return false;
+   id.device = st.st_dev;
+   id.inode = st.st_ino;
+   id.size = st.st_size;
+   id.modified = st.st_mtime;
+   id.regular = S_ISREG(st.st_mode);
+#else
+   boost::system::error_code ec;
+   boost::filesystem::path canonical = boost::filesystem::canonical(file, ec);
+   if(ec)
+      return false;
+   id.device = id.inode = 0;
+   id.regular = boost::filesystem::is_regular_file(canonical, ec);
+   id.size = id.regular ? boost::filesystem::file_size(canonical, ec) : 0;
+   id.modified = boost::filesystem::last_write_time(canonical, ec);
+   id.path = canonical.string();
+   if(ec)
+      return false;
+#endif
+   return true;
+}
+
+namespace
+{
+   //
+   // The scanners that have already been run over each file, a scanner added
+   // later, or one whose file name filter didn't match the path we saw the
+   // file under before, still has to be run over it:
+   //
+   std::map<file_identity, std::set<const file_scanner*> > scanned_files;
 }
 //
 // Scan a source file for things to index:
@@ -141,16 +177,50 @@ void scan_file(const std::string& file)
 {
    if(need_defaults)
       install_default_scanners();
+   file_identity id;
+   if(!get_file_identity(file, id) || !id.regular || !id.size)
+      throw std::runtime_error(std::string("Unable to read from file: ") + file);
+   std::set<const file_scanner*>& done = scanned_files[id];
+   if(done.size())
+   {
+      bool pending = false;
+      for(file_scanner_set_type::iterator pscan = file_scanner_set.begin(); !pending && (pscan != file_scanner_set.end()); ++pscan)
+      {
+         if(!done.count(&*pscan) && (pscan->file_name_filter.empty() || regex_match(file, pscan->file_name_filter)))
+            pending = true;
+      }
+      if(!pending)
+      {
+         if(verbose)
+            std::cout << "Skipping file already scanned... " << file << std::endl;
+         return;
+      }
+   }
    if(verbose)
       std::cout << "Scanning file... " << file << std::endl;
-   std::string text;
-   std::ifstream is(file.c_str());
-   if(!is.peek() || !is.good())
+   //
+   // Map the whole file into memory and scan it in place:
+   //
+   boost::interprocess::file_mapping mapping;
+   boost::interprocess::mapped_region region;
+   try
+   {
+      boost::interprocess::file_mapping(file.c_str(), boost::interprocess::read_only).swap(mapping);
+      boost::interprocess::mapped_region(mapping, boost::interprocess::read_only, 0, static_cast<std::size_t>(id.size)).swap(region);
+   }
+   catch(const boost::interprocess::interprocess_exception&)
+   {
+      throw std::runtime_error(std::string("Unable to read from file: ") + file);
+   }
+   const char* text_first = static_cast<const char*>(region.get_address());
+   const char* text_last = text_first + region.get_size();
+   if(!*text_first)
       throw std::runtime_error(std::string("Unable to read from file: ") + file);
-   load_file(text, is);
 
    for(file_scanner_set_type::iterator pscan = file_scanner_set.begin(); pscan != file_scanner_set.end(); ++pscan)
    {
+      if(done.count(&*pscan))
+         continue;  // Already run over this file.
       bool need_debug = false;
       if(!debug.empty() && regex_match(pscan->type, ::debug))
       {
@@ -173,20 +243,25 @@ void scan_file(const std::string& file)
             continue;  // skip this file
          }
       }
+      done.insert(&*pscan);
       if(verbose && !need_debug)
          std::cout << "Scanning for type \"" << (*pscan).type << "\" ... " << std::endl;
-      boost::sregex_iterator i(text.begin(), text.end(), (*pscan).scanner), j;
+      boost::cregex_iterator i(text_first, text_last, (*pscan).scanner), j;
       while(i != j)
       {
          try
          {
             index_info info;
-            info.term = escape_to_xml(i->format(pscan->term_formatter));
+            info.term = interned_string(escape_to_xml(i->format(pscan->term_formatter)));
             info.search_text = i->format(pscan->format_string);
-            info.category = pscan->type;
+            info.category = interned_string(pscan->type);
             if(!pscan->section_filter.empty())
-               info.search_id = pscan->section_filter;
-            std::pair<std::set<index_info>::iterator, bool> pos = index_terms.insert(info);
+               info.search_id = lazy_regex(pscan->section_filter);
+            // Skip the term if either expression isn't valid, rather than failing the run when it's first used:
+            info.search_text.check();
+            if(!info.search_id.empty())
+               info.search_id.check();
+            std::pair<index_term_set::iterator, bool> pos = index_terms.insert_scanned(info);
             if(pos.second)
             {
                if(verbose || need_debug)
@@ -200,16 +275,20 @@ void scan_file(const std::string& file)
                   //
                   // Merge the search terms:
                   //
-                  const_cast<boost::regex&>(pos.first->search_text) = 
-                     "(?:" + pos.first->search_text.str() + ")|(?:" + info.search_text.str() + ")";
+                  lazy_regex merged;
+                  merged = "(?:" + pos.first->search_text.str() + ")|(?:" + info.search_text.str() + ")";
+                  merged.check();
+                  const_cast<lazy_regex&>(pos.first->search_text) = merged;
                }
                if(pos.first->search_id != info.search_id)
                {
                   //
                   // Merge the ID constraints:
                   //
-                  const_cast<boost::regex&>(pos.first->search_id) = 
-                     "(?:" + pos.first->search_id.str() + ")|(?:" + info.search_id.str() + ")";
+                  lazy_regex merged;
+                  merged = "(?:" + pos.first->search_id.str() + ")|(?:" + info.search_id.str() + ")";
+                  merged.check();
+                  const_cast<lazy_regex&>(pos.first->search_id) = merged;
                }
             }
          }
@@ -231,28 +310,6 @@ void scan_file(const std::string& file)
    }
 }
 //
-// Scan a whole directory for files to search:
-//
-void scan_dir(const std::string& dir, const std::string& mask, bool recurse)
-{
-   using namespace boost::filesystem;
-   boost::regex e(mask);
-   directory_iterator i(dir), j;
-
-   while(i != j)
-   {
-      if(regex_match(i->path().filename().string(), e))
-      {
-         scan_file(i->path().string());
-      }
-      else if(recurse && is_directory(i->status()))
-      {
-         scan_dir(i->path().string(), mask, recurse);
-      }
-      ++i;
-   }
-}
-//
 // Remove quotes from a string:
 //
 std::string unquote(const std::string& s)
@@ -414,16 +471,7 @@ void process_script(const std::string& script)
          boost::sregex_token_iterator i(line.begin() + 9, line.end(), delim, 0), j;
          while(i != j)
          {
-            index_info info;
-            info.term = escape_to_xml(unquote(*i));
-            // Erase all entries that have a category in our scanner set,
-            // plus any entry with no category at all:
-            index_terms.erase(info);
-            for(file_scanner_set_type::iterator pscan = file_scanner_set.begin(); pscan != file_scanner_set.end(); ++pscan)
-            {
-               info.category = (*pscan).type;
-               index_terms.erase(info);
-            }
+            index_terms.exclude(interned_string(escape_to_xml(unquote(*i))));
             ++i;
          }
       }
@@ -440,19 +488,19 @@ void process_script(const std::string& script)
             // in order for the term to be indexed (optional)
             // what[4] is the index category to place the term in (optional).
             index_info info;
-            info.term = escape_to_xml(unquote(what.str(1)));
+            info.term = interned_string(escape_to_xml(unquote(what.str(1))));
             std::string s = unquote(what.str(2));
             if(s.size())
-               info.search_text = boost::regex(s, boost::regex::icase|boost::regex::perl);
+               info.search_text = lazy_regex(s, boost::regex::icase|boost::regex::perl);
             else
-               info.search_text = boost::regex("\\<" + what.str(1) + "\\>", boost::regex::icase|boost::regex::perl);
+               info.search_text = lazy_regex("\\<" + what.str(1) + "\\>", boost::regex::icase|boost::regex::perl);
 
             s = unquote(what.str(3));
             if(s.size())
                info.search_id = s;
             if(what[4].matched)
-               info.category = unquote(what.str(4));
-            std::pair<std::set<index_info>::iterator, bool> pos = index_terms.insert(info);
+               info.category = interned_string(unquote(what.str(4)));
+            std::pair<index_term_set::iterator, bool> pos = index_terms.insert(info);
             if(pos.second)
             {
                if(pos.first->search_text != info.search_text)
@@ -460,7 +508,7 @@ void process_script(const std::string& script)
                   //
                   // Merge the search terms:
                   //
-                  const_cast<boost::regex&>(pos.first->search_text) = 
+                  const_cast<lazy_regex&>(pos.first->search_text) = 
                      "(?:" + pos.first->search_text.str() + ")|(?:" + info.search_text.str() + ")";
                }
                if(pos.first->search_id != info.search_id)
@@ -468,7 +516,7 @@ void process_script(const std::string& script)
                   //
                   // Merge the ID constraints:
                   //
-                  const_cast<boost::regex&>(pos.first->search_id) = 
+                  const_cast<lazy_regex&>(pos.first->search_id) = 
                      "(?:" + pos.first->search_id.str() + ")|(?:" + info.search_id.str() + ")";
                }
             }
@@ -0,0 +1,112 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Exports the index entries as JSON, for tools that want the index without
+// parsing the DocBook: one object per entry, in index order, with the text of
+// the entry, and its category, link id, preferred flag and sub-entries where
+// it has them:
+//
+//    {"entries":[
+//    {"term":"add_const","category":"class_name","entries":[{"term":"add_const","id":"boost_typetraits.reference.add_const","preferred":true}]},
+//    ...
+//    ]}
+//
+// Each top level entry goes on a line of its own.  The text is that of the
+// document with any XML escapes replaced, and is assumed to be UTF-8.
+//
+
+#include "auto_index.hpp"
+
+namespace
+{
+   void write_json_string(std::ostream& os, const std::string& s)
+   {
+      static const char hex[] = "0123456789abcdef";
+      os.put('"');
+      for(std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+      {
+         switch(*i)
+         {
+         case '"':
+            os << "\\\"";
+            break;
+         case '\\':
+            os << "\\\\";
+            break;
+         case '\n':
+            os << "\\n";
+            break;
+         case '\r':
+            os << "\\r";
+            break;
+         case '\t':
+            os << "\\t";
+            break;
+         default:
+            if(static_cast<unsigned char>(*i) < 0x20)
+               os << "\\u00" << hex[(*i >> 4) & 0xF] << hex[*i & 0xF];
+            else
+               os.put(*i);
+         }
+      }
+      os.put('"');
+   }
+}
+
+void export_index_entries(const index_entry_set& entries, const std::string& file)
+{
+   std::ofstream os(file.c_str(), std::ios_base::binary);
+   if(!os.good())
+      throw std::runtime_error("Could not create index export file: " + file);
+   os << "{\"entries\":[";
+   typedef std::pair<const index_entry_set*, index_entry_set::const_iterator> frame;
+   std::vector<frame> stack(1, frame(&entries, entries.begin()));
+   std::size_t count = 0;
+   while(!stack.empty())
+   {
+      frame& f = stack.back();
+      if(f.second == f.first->end())
+      {
+         // Close the list, and the entry it belongs to (or the whole export):
+         os << (stack.size() == 1 ? "\n]}\n" : "]}");
+         stack.pop_back();
+         continue;
+      }
+      if(f.second != f.first->begin())
+         os.put(',');
+      if(stack.size() == 1)
+         os.put('\n');
+      const index_entry& e = **f.second++;
+      ++count;
+      os << "{\"term\":";
+      write_json_string(os, unescape_xml(e.key.str()));
+      if(e.category.size())
+      {
+         os << ",\"category\":";
+         write_json_string(os, e.category.str());
+      }
+      if(e.id.size())
+      {
+         os << ",\"id\":";
+         write_json_string(os, e.id.str());
+      }
+      if(e.preferred)
+         os << ",\"preferred\":true";
+      if(e.sub_keys.empty())
+         os.put('}');
+      else
+      {
+         os << ",\"entries\":[";
+         stack.push_back(frame(&e.sub_keys, e.sub_keys.begin()));
+      }
+   }
+   if(!os.good())
+      throw std::runtime_error("Error writing index export file: " + file);
+   if(verbose)
+      std::cout << "Exported " << count << " index entries to " << file << std::endl;
+}
@@ -8,16 +8,19 @@
 #include "auto_index.hpp"
 #include <boost/range.hpp>
 #include <boost/format.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/exception_ptr.hpp>
+#include <vector>
 
 //
-// Get a numerical ID for the next item:
+// Get the numerical ID of a letter heading: every index reserves one ID for
+// each initial letter in the whole entry set, whether or not it uses it:
 //
-std::string get_next_index_id()
+std::string make_index_id(int n)
 {
-   static int index_id_count = 0;
    std::stringstream s;
-   s << "idx_id_" << index_id_count;
-   ++index_id_count;
+   s << "idx_id_" << n;
    return s.str();
 }
 
@@ -147,121 +150,442 @@ boost::tiny_xml::element_ptr add_attribute(boost::tiny_xml::element_ptr ptr, con
    return ptr;
 }
 
-boost::regex make_primary_key_matcher(const std::string& s)
+//
+// Normalise a key for comparison with other keys: case is ignored, and
+// any run of '-', '_' or whitespace compares equal to any other such run:
+//
+std::string make_match_key(const std::string& s)
 {
-   static const boost::regex e("[-_[:space:]]+|([.\\[{}()\\*+?|^$])");
-   static const char* format = "(?1\\\\$1:[-_[:space:]]+)";
-   return boost::regex(regex_replace(s, e, format, boost::regex_constants::format_all), boost::regex::icase|boost::regex::perl);
+   std::string result;
+   result.reserve(s.size());
+   bool in_separator = false;
+   for(std::string::const_iterator i = s.begin(); i != s.end(); ++i)
+   {
+      if((*i == '-') || (*i == '_') || std::isspace(static_cast<unsigned char>(*i)))
+      {
+         if(!in_separator)
+            result.append(1, ' ');
+         in_separator = true;
+      }
+      else
+      {
+         result.append(1, static_cast<char>(std::toupper(static_cast<unsigned char>(*i))));
+         in_separator = false;
+      }
+   }
+   return result;
 }
-
 //
-// Generate an index entry using our own internal method:
+// A top level index entry along with the data that every index generated
+// from it needs, computed once up front:
 //
+struct bucket_entry
+{
+   index_entry_ptr entry;
+   std::string match_key;  // make_match_key(entry->key)
+   int letter_group;       // which initial letter heading this entry goes under
+};
+typedef std::vector<const bucket_entry*> index_bucket;
+
+inline const index_entry_ptr& get_entry(const index_entry_ptr& p) { return p; }
+inline const index_entry_ptr& get_entry(const bucket_entry& p) { return p.entry; }
+inline const std::string& get_match_key(const index_entry_ptr& p, std::string& storage) { return storage = make_match_key(p->key.str()); }
+inline const std::string& get_match_key(const bucket_entry& p, std::string&) { return p.match_key; }
+
+void warn_duplicate_destination()
+{
+   static boost::mutex m;
+   boost::mutex::scoped_lock l(m);
+   std::cerr << "WARNING: two identical index terms have different link destinations!!" << std::endl;
+}
+
 template <class Range>
-boost::tiny_xml::element_ptr generate_entry(const Range& range, const std::string* pcategory, int level = 0, const boost::regex* primary_key = 0)
+boost::tiny_xml::element_ptr generate_entry(const Range& range, int level = 0, const std::string* primary_key = 0);
+//
+// Generate an index entry using our own internal method: appends to list the
+// item for the entries in [i, end) with the same key as *i, and returns the
+// first entry with a different key.  primary_key is set for top level entries:
+//
+template <class Iterator>
+Iterator generate_item(Iterator i, Iterator end, boost::tiny_xml::element_ptr list, int level, const std::string*& primary_key, std::string& match_key_storage)
 {
-   boost::tiny_xml::element_ptr list = add_attribute(add_attribute(::add_attribute(make_element("itemizedlist"), "mark", "none"), "spacing", "compact"), "role", "index");
+   interned_string key = get_entry(*i)->key;
+   index_entry_set entries;
+   bool preferred = false;
+   interned_string id;
+   bool collapse = false;
 
-   for(typename boost::range_iterator<Range>::type i = boost::begin(range); i != boost::end(range);)
-   {
-      std::string key = (*i)->key;
-      index_entry_set entries;
-      bool preferred = false;
-      std::string id;
-      bool collapse = false;
-      
-      //
-      // Create a regular expression for comparing key to other key's:
-      //
-      boost::regex key_regex;
-      if(level == 0)
+   //
+   // Sub-keys are compared to the primary key with any case or separator differences ignored:
+   //
+   if(level == 0)
+      primary_key = &get_match_key(*i, match_key_storage);
+   //
+   // Begin by consolidating entries with identical keys but possibly different categories,
+   // any filtering by category has already been done by the caller:
+   //
+   while((i != end) && (get_entry(*i)->key == key))
+   {
+      const index_entry& e = *get_entry(*i);
+      entries.insert(e.sub_keys.begin(), e.sub_keys.end());
+      if(e.preferred)
+         preferred = true;
+      if(e.id.size())
       {
-         key_regex = make_primary_key_matcher(key);
-         primary_key = &key_regex;
+         if(id.size())
+         {
+            warn_duplicate_destination();
+         }
+         id = e.id;
       }
+      ++i;
+   }
+   //
+   // Only actually generate content if we have anything in the entries set:
+   //
+   if(entries.size() || id.size())
+   {
       //
-      // Begin by consolidating entries with identical keys but possibly different categories:
+      // See if we can collapse any sub-entries into this one:
       //
-      while((i != boost::end(range)) && ((*i)->key == key))
+      if(entries.size() == 1)
       {
-         if((0 == pcategory) || (pcategory->size() == 0) || (pcategory && (**i).category == *pcategory))
+         if((((*entries.begin())->key == key) || (make_match_key((*entries.begin())->key.str()) == *primary_key)) 
+            && ((*entries.begin())->id.size()) 
+            && ((*entries.begin())->id != id))
          {
-            entries.insert((*i)->sub_keys.begin(), (*i)->sub_keys.end());
-            if((*i)->preferred)
-               preferred = true;
-            if((*i)->id.size())
-            {
-               if(id.size())
-               {
-                  std::cerr << "WARNING: two identical index terms have different link destinations!!" << std::endl;
-               }
-               id = (*i)->id;
-            }
+            collapse = true;
+            id = (*entries.begin())->id;
          }
-         ++i;
       }
       //
-      // Only actually generate content if we have anything in the entries set:
+      // See if this key is the same as the primary key, if it is then make it prefered:
       //
-      if(entries.size() || id.size())
+      if(level && (make_match_key(key.str()) == *primary_key))
       {
-         //
-         // See if we can collapse any sub-entries into this one:
-         //
-         if(entries.size() == 1)
-         {
-            if((regex_match((*entries.begin())->key, *primary_key) || ((*entries.begin())->key == key)) 
-               && ((*entries.begin())->id.size()) 
-               && ((*entries.begin())->id != id))
-            {
-               collapse = true;
-               id = (*entries.begin())->id;
-            }
-         }
-         //
-         // See if this key is the same as the primary key, if it is then make it prefered:
-         //
-         if(level && regex_match(key, *primary_key))
-         {
-            preferred = true;
-         }
-         boost::tiny_xml::element_ptr item = make_element("listitem");
-         boost::tiny_xml::element_ptr para = make_element("para");
-         item->elements.push_back(para);
-         list->elements.push_back(item);
-         if(preferred)
-         {
-            para->elements.push_back(add_attribute(make_element("emphasis"), "role", "bold"));
-            para = para->elements.back();
-         }
-         if(id.size())
-         {
-            boost::tiny_xml::element_ptr link = add_attribute(make_element("link"), "linkend", id);
-            para->elements.push_back(link);
-            para = link;
-         }
-         std::string classname = (boost::format("index-entry-level-%1%") % level).str();
-         para->elements.push_back(add_attribute(make_element("phrase"), "role", classname));
+         preferred = true;
+      }
+      boost::tiny_xml::element_ptr item = make_element("listitem");
+      boost::tiny_xml::element_ptr para = make_element("para");
+      item->elements.push_back(para);
+      list->elements.push_back(item);
+      if(preferred)
+      {
+         para->elements.push_back(add_attribute(make_element("emphasis"), "role", "bold"));
          para = para->elements.back();
-         para->content = key;
-         if(!collapse && entries.size())
-         {
-            std::pair<index_entry_set::const_iterator, index_entry_set::const_iterator> subrange(entries.begin(), entries.end());
-            item->elements.push_back(generate_entry(subrange, 0, level+1, primary_key));
-         }
+      }
+      if(id.size())
+      {
+         boost::tiny_xml::element_ptr link = add_attribute(make_element("link"), "linkend", id.str());
+         para->elements.push_back(link);
+         para = link;
+      }
+      std::string classname = (boost::format("index-entry-level-%1%") % level).str();
+      para->elements.push_back(add_attribute(make_element("phrase"), "role", classname));
+      para = para->elements.back();
+      para->content = key.str();
+      if(!collapse && entries.size())
+      {
+         item->elements.push_back(generate_entry(entries, level+1, primary_key));
       }
    }
+   return i;
+}
+
+boost::tiny_xml::element_ptr make_entry_list()
+{
+   return add_attribute(add_attribute(::add_attribute(make_element("itemizedlist"), "mark", "none"), "spacing", "compact"), "role", "index");
+}
+
+template <class Range>
+boost::tiny_xml::element_ptr generate_entry(const Range& range, int level, const std::string* primary_key)
+{
+   boost::tiny_xml::element_ptr list = make_entry_list();
+   std::string match_key_storage;
+   for(typename boost::range_iterator<const Range>::type i = boost::begin(range); i != boost::end(range);)
+      i = generate_item(i, boost::end(range), list, level, primary_key, match_key_storage);
    return list;
 }
 //
+// The generated content of one <index>:
+//
+struct index_body
+{
+   boost::tiny_xml::element_ptr navbar, vlist;
+};
+//
+// Builds the navigation bar and variable list for one index, from the entries
+// in its category bucket given one at a time, in order.  first_id is the ID
+// of the first letter heading.  Each entry is only kept until the next one
+// with a different key arrives:
+//
+class index_body_builder
+{
+public:
+   explicit index_body_builder(int first_id) : m_first_id(first_id), m_group(-1)
+   {
+      m_body.navbar = make_element("para");
+      m_body.vlist = make_element("variablelist");
+   }
+   void add(const bucket_entry& e)
+   {
+      if(e.letter_group != m_group)
+      {
+         end_group();
+         m_group = e.letter_group;
+         m_letter = static_cast<char>(std::toupper(e.entry->key[0]));
+         m_list = make_entry_list();
+      }
+      else if(e.entry->key != m_pending.back().entry->key)
+         flush();
+      m_pending.push_back(e);
+   }
+   index_body finish()
+   {
+      end_group();
+      return m_body;
+   }
+private:
+   void flush()
+   {
+      const std::string* primary_key = 0;
+      std::string match_key_storage;
+      generate_item(m_pending.begin(), m_pending.end(), m_list, 0, primary_key, match_key_storage);
+      m_pending.clear();
+   }
+   void end_group()
+   {
+      if(m_pending.empty())
+         return;
+      flush();
+      if(m_list->elements.empty())
+         return;
+      std::string id_name = make_index_id(m_first_id + m_group);
+      boost::tiny_xml::element_ptr entry = add_attribute(make_element("varlistentry"), "id", id_name);
+      boost::tiny_xml::element_ptr term = make_element("term");
+      term->content = std::string(1, m_letter);
+      entry->elements.push_back(term);
+      boost::tiny_xml::element_ptr item = make_element("listitem");
+      entry->elements.push_back(item);
+      item->elements.push_back(m_list);
+      m_body.vlist->elements.push_back(entry);
+      boost::tiny_xml::element_ptr p = make_element("");
+      p->content = " ";
+      if(m_body.navbar->elements.size())
+      {
+         m_body.navbar->elements.push_back(p);
+      }
+      p = add_attribute(make_element("link"), "linkend", id_name);
+      p->content = m_letter;
+      m_body.navbar->elements.push_back(p);
+   }
+
+   index_body m_body;
+   int m_first_id;
+   int m_group;
+   char m_letter;
+   boost::tiny_xml::element_ptr m_list;
+   std::vector<bucket_entry> m_pending;
+};
+
+index_body generate_index_body(const index_bucket& bucket, int first_id)
+{
+   index_body_builder builder(first_id);
+   for(index_bucket::const_iterator i = bucket.begin(); i != bucket.end(); ++i)
+      builder.add(**i);
+   return builder.finish();
+}
+//
+// Worker for generating several indexes at once: each thread takes every
+// stride'th index starting from first.
+//
+struct index_body_generator
+{
+   const std::vector<const index_bucket*>* buckets;
+   std::vector<int>* first_ids;
+   std::vector<index_body>* results;
+   std::size_t first, stride;
+   boost::exception_ptr* error;
+
+   void operator()()const
+   {
+      try
+      {
+         for(std::size_t i = first; i < buckets->size(); i += stride)
+            (*results)[i] = generate_index_body(*(*buckets)[i], (*first_ids)[i]);
+      }
+      catch(...)
+      {
+         *error = boost::current_exception();
+      }
+   }
+};
+//
+// The category of the entries that each index lists, empty for all of them:
+//
+std::vector<interned_string> get_index_categories()
+{
+   std::vector<interned_string> result;
+   for(boost::tiny_xml::element_list::const_iterator i = indexes.begin(); i != indexes.end(); ++i)
+   {
+      const std::string* category = find_attr(*i, "type");
+      result.push_back(category ? interned_string(*category) : interned_string());
+   }
+   return result;
+}
+//
+// The ID of the first letter heading of each index, each of which reserves
+// letter_groups of them:
+//
+std::vector<int> allocate_index_ids(int letter_groups)
+{
+   static int index_id_count = 0;
+   std::vector<int> first_ids;
+   for(std::size_t i = 0; i < indexes.size(); ++i)
+   {
+      first_ids.push_back(index_id_count);
+      index_id_count += letter_groups;
+   }
+   return first_ids;
+}
+//
+// Generates the content of each index from the entries in memory:
+//
+void generate_index_bodies(std::vector<index_body>& bodies)
+{
+   //
+   // Start by sorting the entries into per-category buckets in a single pass,
+   // computing the comparison key and letter heading of each as we go,
+   // every index with no type attribute uses all of the entries:
+   //
+   std::vector<bucket_entry> all_entries;
+   all_entries.reserve(index_entries.size());
+   int letter_groups = 0;
+   for(index_entry_set::const_iterator i = index_entries.begin(); i != index_entries.end(); ++i)
+   {
+      bucket_entry e;
+      e.entry = *i;
+      e.match_key = make_match_key((*i)->key.str());
+      if(all_entries.empty() || (std::toupper((*i)->key[0]) != std::toupper(all_entries.back().entry->key[0])))
+         ++letter_groups;
+      e.letter_group = letter_groups - 1;
+      all_entries.push_back(e);
+   }
+   index_bucket all_bucket;
+   all_bucket.reserve(all_entries.size());
+   std::map<interned_string, index_bucket> category_buckets;
+   for(std::vector<bucket_entry>::const_iterator i = all_entries.begin(); i != all_entries.end(); ++i)
+   {
+      all_bucket.push_back(&*i);
+      if(!i->entry->category.empty())
+         category_buckets[i->entry->category].push_back(&*i);
+   }
+   //
+   // Figure out which bucket each index uses, and which IDs it gets for its letter headings:
+   //
+   static const index_bucket empty_bucket;
+   std::vector<interned_string> categories = get_index_categories();
+   std::vector<const index_bucket*> buckets;
+   std::vector<int> first_ids = allocate_index_ids(letter_groups);
+   for(std::vector<interned_string>::const_iterator i = categories.begin(); i != categories.end(); ++i)
+   {
+      if(i->empty())
+         buckets.push_back(&all_bucket);
+      else
+      {
+         std::map<interned_string, index_bucket>::const_iterator pos = category_buckets.find(*i);
+         buckets.push_back(pos == category_buckets.end() ? &empty_bucket : &pos->second);
+      }
+   }
+   //
+   // Each index is independent of the others, so generate them in parallel:
+   //
+   std::size_t thread_count = (std::min)(buckets.size(), static_cast<std::size_t>(boost::thread::hardware_concurrency()));
+   if(thread_count < 2)
+   {
+      for(std::size_t i = 0; i < buckets.size(); ++i)
+         bodies[i] = generate_index_body(*buckets[i], first_ids[i]);
+   }
+   else
+   {
+      std::vector<boost::exception_ptr> errors(thread_count);
+      boost::thread_group threads;
+      for(std::size_t i = 0; i < thread_count; ++i)
+      {
+         index_body_generator g = { &buckets, &first_ids, &bodies, i, thread_count, &errors[i] };
+         threads.create_thread(g);
+      }
+      threads.join_all();
+      for(std::size_t i = 0; i < thread_count; ++i)
+      {
+         if(errors[i])
+            boost::rethrow_exception(errors[i]);
+      }
+   }
+}
+//
+// Generates the content of each index while merging the entries spilled with
+// --memory-limit, handing each merged entry to every index that lists it and
+// then dropping it, rather than merging them all back into memory first:
+//
+void generate_index_bodies_from_spilled_entries(std::vector<index_body>& bodies)
+{
+   //
+   // The IDs of the letter headings depend on how many there are in all, so
+   // count them first, which only needs the keys:
+   //
+   int letter_groups = 0;
+   int letter = 0;
+   index_entry_merger keys;
+   index_entry_ptr key;
+   while(keys.next(key, true))
+   {
+      if(!letter_groups || (std::toupper(key->key[0]) != letter))
+         ++letter_groups;
+      letter = std::toupper(key->key[0]);
+   }
+   std::vector<interned_string> categories = get_index_categories();
+   std::vector<int> first_ids = allocate_index_ids(letter_groups);
+   std::vector<boost::shared_ptr<index_body_builder> > builders;
+   for(std::size_t i = 0; i < first_ids.size(); ++i)
+      builders.push_back(boost::shared_ptr<index_body_builder>(new index_body_builder(first_ids[i])));
+
+   int group = -1;
+   index_entry_merger merger;
+   bucket_entry e;
+   while(merger.next(e.entry))
+   {
+      e.match_key = make_match_key(e.entry->key.str());
+      if((group < 0) || (std::toupper(e.entry->key[0]) != letter))
+         ++group;
+      letter = std::toupper(e.entry->key[0]);
+      e.letter_group = group;
+      for(std::size_t i = 0; i < builders.size(); ++i)
+      {
+         if(categories[i].empty() || (categories[i] == e.entry->category))
+            builders[i]->add(e);
+      }
+   }
+   for(std::size_t i = 0; i < builders.size(); ++i)
+      bodies[i] = builders[i]->finish();
+}
+//
 // Generate indexes using our own internal method:
 //
 void generate_indexes()
 {
-   for(boost::tiny_xml::element_list::const_iterator i = indexes.begin(); i != indexes.end(); ++i)
+   std::vector<index_body> bodies(indexes.size());
+   if(have_spilled_index_entries())
+      generate_index_bodies_from_spilled_entries(bodies);
+   else
+      generate_index_bodies(bodies);
+   //
+   // Now insert the results into the document:
+   //
+   std::size_t index_number = 0;
+   for(boost::tiny_xml::element_list::const_iterator i = indexes.begin(); i != indexes.end(); ++i, ++index_number)
    {
       boost::tiny_xml::element_ptr node = *i;
-      const std::string* category = find_attr(node, "type");
       bool has_title = false;
 
       for(boost::tiny_xml::element_list::const_iterator k = (*i)->elements.begin(); k != (*i)->elements.end(); ++k)
@@ -273,42 +597,8 @@ void generate_indexes()
          }
       }
 
-      boost::tiny_xml::element_ptr navbar = make_element("para");
-      node->elements.push_back(navbar);
-
-      index_entry_set::const_iterator m = index_entries.begin();
-      index_entry_set::const_iterator n = m;
-      boost::tiny_xml::element_ptr vlist = make_element("variablelist");
-      node->elements.push_back(vlist);
-      while(n != index_entries.end())
-      {
-         char current_letter = std::toupper((*n)->key[0]);
-         std::string id_name = get_next_index_id();
-         boost::tiny_xml::element_ptr entry = add_attribute(make_element("varlistentry"), "id", id_name);
-         boost::tiny_xml::element_ptr term = make_element("term");
-         term->content = std::string(1, current_letter);
-         entry->elements.push_back(term);
-         boost::tiny_xml::element_ptr item = make_element("listitem");
-         entry->elements.push_back(item);
-         while((n != index_entries.end()) && (std::toupper((*n)->key[0]) == current_letter))
-            ++n;
-         std::pair<index_entry_set::const_iterator, index_entry_set::const_iterator> range(m, n);
-         item->elements.push_back(generate_entry(range, category));
-         if(item->elements.size() && (*item->elements.begin())->elements.size())
-         {
-            vlist->elements.push_back(entry);
-            boost::tiny_xml::element_ptr p = make_element("");
-            p->content = " ";
-            if(navbar->elements.size())
-            {
-               navbar->elements.push_back(p);
-            }
-            p = add_attribute(make_element("link"), "linkend", id_name);
-            p->content = current_letter;
-            navbar->elements.push_back(p);
-         }
-         m = n;
-      }
+      node->elements.push_back(bodies[index_number].navbar);
+      node->elements.push_back(bodies[index_number].vlist);
 
       node->name = internal_index_type;
       boost::tiny_xml::element_ptr p(node->parent);
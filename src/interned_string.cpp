@@ -0,0 +1,80 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "interned_string.hpp"
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <ostream>
+
+namespace
+{
+   struct pooled_string_hash
+   {
+      std::size_t operator()(const std::string* p)const
+      {
+         return boost::hash_range(p->begin(), p->end());
+      }
+   };
+   struct pooled_string_equal
+   {
+      bool operator()(const std::string* a, const std::string* b)const
+      {
+         return *a == *b;
+      }
+   };
+   //
+   // The strings themselves are allocated in a deque, which grows in blocks
+   // and never moves its elements, the hash set indexes them by value:
+   //
+   class string_pool
+   {
+   public:
+      const std::string* intern(const std::string& s)
+      {
+         boost::mutex::scoped_lock lock(m_mutex);
+         lookup_type::const_iterator pos = m_lookup.find(&s);
+         if(pos != m_lookup.end())
+            return *pos;
+         m_storage.push_back(s);
+         const std::string* result = &m_storage.back();
+         m_lookup.insert(result);
+         return result;
+      }
+   private:
+      typedef boost::unordered_set<const std::string*, pooled_string_hash, pooled_string_equal> lookup_type;
+      boost::mutex m_mutex;
+      std::deque<std::string> m_storage;
+      lookup_type m_lookup;
+   };
+
+   string_pool& get_pool()
+   {
+      static string_pool pool;
+      return pool;
+   }
+
+   const std::string* empty_string()
+   {
+      static const std::string* result = get_pool().intern(std::string());
+      return result;
+   }
+}
+
+interned_string::interned_string() : m_str(empty_string()) {}
+
+interned_string::interned_string(const std::string& s)
+   : m_str(s.empty() ? empty_string() : get_pool().intern(s)) {}
+
+interned_string::interned_string(const char* s)
+   : m_str(*s ? get_pool().intern(std::string(s)) : empty_string()) {}
+
+std::ostream& operator << (std::ostream& os, const interned_string& s)
+{
+   return os << s.str();
+}
@@ -0,0 +1,55 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BOOST_AUTO_INDEX_INTERNED_STRING_HPP
+#define BOOST_AUTO_INDEX_INTERNED_STRING_HPP
+
+#include <string>
+#include <cstddef>
+#include <iosfwd>
+
+//
+// A handle to an immutable string held in a process wide pool: the same
+// text always yields the same handle, so equality and hashing are pointer
+// operations, and each distinct term, title, id or category is stored once
+// no matter how many index entries refer to it.  Interning is thread safe,
+// and the pooled strings live until the program exits.
+//
+class interned_string
+{
+public:
+   interned_string();
+   explicit interned_string(const std::string& s);
+   explicit interned_string(const char* s);
+
+   const std::string& str()const { return *m_str; }
+   const char* c_str()const { return m_str->c_str(); }
+   std::size_t size()const { return m_str->size(); }
+   bool empty()const { return m_str->empty(); }
+   char operator[](std::size_t i)const { return (*m_str)[i]; }
+
+   // Uniquely identifies the string for the lifetime of the program:
+   const void* id()const { return m_str; }
+
+   friend bool operator == (const interned_string& a, const interned_string& b) { return a.m_str == b.m_str; }
+   friend bool operator != (const interned_string& a, const interned_string& b) { return a.m_str != b.m_str; }
+   // Ordering is lexicographic, so sorted containers keep their existing order:
+   friend bool operator < (const interned_string& a, const interned_string& b) { return (a.m_str != b.m_str) && (*a.m_str < *b.m_str); }
+
+   friend bool operator == (const interned_string& a, const std::string& b) { return *a.m_str == b; }
+   friend bool operator != (const interned_string& a, const std::string& b) { return *a.m_str != b; }
+   friend bool operator == (const std::string& a, const interned_string& b) { return a == *b.m_str; }
+   friend bool operator != (const std::string& a, const interned_string& b) { return a != *b.m_str; }
+
+   friend std::size_t hash_value(const interned_string& s) { return reinterpret_cast<std::size_t>(s.m_str); }
+private:
+   const std::string* m_str;
+};
+
+std::ostream& operator << (std::ostream& os, const interned_string& s);
+
+#endif
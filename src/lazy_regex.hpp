@@ -0,0 +1,285 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BOOST_AUTO_INDEX_LAZY_REGEX_HPP
+#define BOOST_AUTO_INDEX_LAZY_REGEX_HPP
+
+#include <boost/regex.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+//
+// Converts text to the lower case form that case folded expressions are
+// matched against, only ASCII letters are changed:
+//
+inline void fold_case(const std::string& in, std::string& out)
+{
+   out.resize(in.size());
+   for(std::string::size_type i = 0; i < in.size(); ++i)
+   {
+      char c = in[i];
+      out[i] = ((c >= 'A') && (c <= 'Z')) ? static_cast<char>(c - 'A' + 'a') : c;
+   }
+}
+
+//
+// A regular expression which is only compiled the first time it's used, so that
+// terms which never get as far as being searched for cost nothing to set up.
+// The compiled form is cached, and may be safely shared between threads.
+//
+// Case insensitive expressions made up of nothing but literal text and word
+// boundaries are compiled as case sensitive lower case expressions instead,
+// which are much cheaper to match: these have to be searched for in text that's
+// been through fold_case, and case_folded() says when that's so.  Where that
+// leaves no more than a plain string search, search() does just that.
+//
+class lazy_regex
+{
+public:
+   lazy_regex() : m_flags(boost::regex::perl), m_folded(false), m_literal_search(false), m_before(0), m_after(0), m_ready(0) {}
+   explicit lazy_regex(const std::string& s, boost::regex::flag_type f = boost::regex::perl)
+      : m_str(s), m_flags(f), m_folded(false), m_literal_search(false), m_before(0), m_after(0), m_ready(0)
+   {
+      analyse();
+   }
+   // From an expression that's already been compiled, which is shared rather than compiled again:
+   explicit lazy_regex(const boost::regex& e) : m_str(e.str()), m_flags(e.flags()), m_folded(false), m_literal_search(false), m_before(0), m_after(0), m_ready(0)
+   {
+      boost::shared_ptr<compiled_regex> c(new compiled_regex);
+      c->e = e;
+      m_compiled = c;
+      m_ready.store(c.get(), boost::memory_order_release);
+   }
+   lazy_regex(const lazy_regex& other)
+      : m_str(other.m_str), m_flags(other.m_flags), m_folded(other.m_folded),
+      m_literal_search(other.m_literal_search), m_literal(other.m_literal),
+      m_before(other.m_before), m_after(other.m_after), m_ready(0)
+   {
+      copy_compiled(other);
+   }
+   lazy_regex& operator=(const lazy_regex& other)
+   {
+      m_str = other.m_str;
+      m_flags = other.m_flags;
+      m_folded = other.m_folded;
+      m_literal_search = other.m_literal_search;
+      m_literal = other.m_literal;
+      m_before = other.m_before;
+      m_after = other.m_after;
+      copy_compiled(other);
+      return *this;
+   }
+   lazy_regex& operator=(const std::string& s)
+   {
+      m_str = s;
+      m_flags = boost::regex::perl;
+      m_folded = false;
+      m_literal_search = false;
+      m_ready.store(0, boost::memory_order_release);
+      m_compiled.reset();
+      return *this;
+   }
+
+   bool empty()const { return m_str.empty(); }
+   const std::string& str()const { return m_str; }
+   boost::regex::flag_type flags()const { return m_flags; }
+   bool case_folded()const { return m_folded; }
+   //
+   // Returns the compiled expression, throwing std::runtime_error if it's
+   // not valid, so that an invalid expression fails the run the first time
+   // it's needed.  Once compiled this is just an atomic load, the first use
+   // takes a lock while compiling:
+   //
+   const boost::regex* get()const
+   {
+      const compiled_regex* c = m_ready.load(boost::memory_order_acquire);
+      if(!c)
+      {
+         boost::mutex::scoped_lock lock(compile_mutex());
+         c = m_ready.load(boost::memory_order_acquire);
+         if(!c)
+         {
+            m_compiled = compile();
+            c = m_compiled.get();
+            m_ready.store(c, boost::memory_order_release);
+         }
+      }
+      return &c->e;
+   }
+   //
+   // Compiles the expression now if that hasn't been done already, for
+   // --compile-script which mustn't save an invalid one, and for scanned terms
+   // which are skipped if they're invalid: throws boost::regex_error if it's
+   // not valid.  Later uses share the compiled form:
+   //
+   void check()const
+   {
+      boost::mutex::scoped_lock lock(compile_mutex());
+      if(m_ready.load(boost::memory_order_acquire))
+         return;
+      m_compiled = compile_now();
+      m_ready.store(m_compiled.get(), boost::memory_order_release);
+   }
+
+   //
+   // Equivalent to regex_search(text, *get()), except that literal text with
+   // nothing more than a word boundary at either end is found without going
+   // near the regex engine at all.  The text must be case folded if case_folded():
+   //
+   bool search(const std::string& text)const
+   {
+      if(m_literal_search)
+         return search_literal(text);
+      return boost::regex_search(text, *get());
+   }
+
+   friend bool operator == (const lazy_regex& a, const lazy_regex& b) { return (a.m_flags == b.m_flags) && (a.m_str == b.m_str); }
+   friend bool operator != (const lazy_regex& a, const lazy_regex& b) { return !(a == b); }
+   friend std::ostream& operator << (std::ostream& os, const lazy_regex& e) { return os << e.m_str; }
+private:
+   struct compiled_regex
+   {
+      boost::regex e;
+   };
+   static boost::mutex& compile_mutex()
+   {
+      static boost::mutex m;
+      return m;
+   }
+   void copy_compiled(const lazy_regex& other)
+   {
+      if(other.m_ready.load(boost::memory_order_acquire))
+      {
+         boost::mutex::scoped_lock lock(compile_mutex());
+         m_compiled = other.m_compiled;
+      }
+      else
+         m_compiled.reset();
+      m_ready.store(m_compiled.get(), boost::memory_order_release);
+   }
+   boost::shared_ptr<const compiled_regex> compile_now()const
+   {
+      boost::shared_ptr<compiled_regex> result(new compiled_regex);
+      if(m_folded)
+      {
+         std::string s;
+         fold_case(m_str, s);
+         result->e.assign(s, m_flags & ~boost::regex::icase);
+      }
+      else
+         result->e.assign(m_str, m_flags);
+      return result;
+   }
+   boost::shared_ptr<const compiled_regex> compile()const
+   {
+      try
+      {
+         return compile_now();
+      }
+      catch(const boost::regex_error& e)
+      {
+         throw std::runtime_error("Unable to compile regular expression \"" + m_str + "\": " + e.what());
+      }
+   }
+   //
+   // Expressions can be case folded if they're case insensitive Perl syntax, and
+   // contain only ASCII literals, escaped punctuation, and the \< \> and \b word
+   // boundaries.  If the boundaries are only at the ends, then we can search for
+   // the literal text directly:
+   //
+   void analyse()
+   {
+      if(((m_flags & boost::regex::icase) == 0) || ((m_flags & ~boost::regex::icase) != boost::regex::perl))
+         return;
+      std::string literal;
+      char before = 0;
+      char after = 0;
+      bool inner_boundary = false;
+      for(std::string::size_type i = 0; i < m_str.size(); ++i)
+      {
+         unsigned char c = static_cast<unsigned char>(m_str[i]);
+         if(c == '\\')
+         {
+            if(++i == m_str.size())
+               return;
+            c = static_cast<unsigned char>(m_str[i]);
+            if((c == '<') || (c == '>') || (c == 'b'))
+            {
+               if(literal.empty() && !before)
+                  before = c;
+               else if(!after)
+                  after = c;
+               else
+                  inner_boundary = true;
+               continue;
+            }
+            // \` and \' are the buffer start and end assertions, not literals:
+            if((c >= 0x80) || std::isalnum(c) || std::isspace(c) || (c == '`') || (c == '\''))
+               return;
+         }
+         else if((c >= 0x80) || !std::isprint(c) || std::strchr(".[]{}()*+?|^$#", c))
+            return;
+         if(after)
+            inner_boundary = true;
+         literal.append(1, static_cast<char>(c));
+      }
+      m_folded = true;
+      if(!inner_boundary && literal.size())
+      {
+         fold_case(literal, m_literal);
+         m_before = before;
+         m_after = after;
+         m_literal_search = true;
+      }
+   }
+   static bool is_word(const std::string& text, std::string::size_type pos)
+   {
+      unsigned char c = static_cast<unsigned char>(text[pos]);
+      return (c < 0x80) && (std::isalnum(c) || (c == '_'));
+   }
+   // Tests for the boundary b between text[pos-1] and text[pos]:
+   static bool at_boundary(char b, const std::string& text, std::string::size_type pos)
+   {
+      bool word_before = (pos > 0) && is_word(text, pos - 1);
+      bool word_after = (pos < text.size()) && is_word(text, pos);
+      switch(b)
+      {
+      case '<': return !word_before && word_after;
+      case '>': return word_before && !word_after;
+      case 'b': return word_before != word_after;
+      }
+      return true;
+   }
+   bool search_literal(const std::string& text)const
+   {
+      std::string::size_type pos = text.find(m_literal);
+      while(pos != std::string::npos)
+      {
+         if(at_boundary(m_before, text, pos) && at_boundary(m_after, text, pos + m_literal.size()))
+            return true;
+         pos = text.find(m_literal, pos + 1);
+      }
+      return false;
+   }
+
+   std::string m_str;
+   boost::regex::flag_type m_flags;
+   bool m_folded;                    // compiled in lower case, and searches folded text
+   bool m_literal_search;            // search() looks for m_literal rather than using the regex
+   std::string m_literal;            // lower case literal text, with
+   char m_before, m_after;           // the boundary before and after it ('<', '>', 'b' or 0)
+   mutable boost::shared_ptr<const compiled_regex> m_compiled;  // owns the compiled form
+   mutable boost::atomic<const compiled_regex*> m_ready;        // set once m_compiled is usable
+};
+
+#endif
@@ -0,0 +1,82 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BOOST_AUTO_INDEX_PACK_IO_HPP
+#define BOOST_AUTO_INDEX_PACK_IO_HPP
+
+//
+// Reading and writing the binary files AutoIndex saves its state in: all
+// integers are 32-bit in the byte order of the machine that wrote the file,
+// and each string is a uint32 length followed by that many bytes.
+//
+
+#include <boost/cstdint.hpp>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+inline void write_u32(std::ostream& os, boost::uint32_t v)
+{
+   os.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+inline void write_string(std::ostream& os, const std::string& s)
+{
+   write_u32(os, static_cast<boost::uint32_t>(s.size()));
+   os.write(s.data(), s.size());
+}
+//
+// Reads from a file held in memory, checking every access against the end of
+// the data, and throwing corrupt_message + file if we run off the end:
+//
+class pack_reader
+{
+public:
+   pack_reader(const char* p, std::size_t n, const std::string& file, const char* corrupt_message)
+      : m_pos(p), m_end(p + n), m_file(file), m_message(corrupt_message) {}
+
+   boost::uint32_t read_u32()
+   {
+      boost::uint32_t v;
+      check(sizeof(v));
+      std::memcpy(&v, m_pos, sizeof(v));
+      m_pos += sizeof(v);
+      return v;
+   }
+   const char* read_bytes(std::size_t n)
+   {
+      check(n);
+      const char* result = m_pos;
+      m_pos += n;
+      return result;
+   }
+   std::string read_string()
+   {
+      boost::uint32_t n = read_u32();
+      check(n);
+      std::string result(m_pos, m_pos + n);
+      m_pos += n;
+      return result;
+   }
+   bool at_end()const { return m_pos == m_end; }
+   void corrupt()const
+   {
+      throw std::runtime_error(m_message + m_file);
+   }
+private:
+   void check(std::size_t n)const
+   {
+      if(static_cast<std::size_t>(m_end - m_pos) < n)
+         corrupt();
+   }
+   const char* m_pos;
+   const char* m_end;
+   std::string m_file;
+   std::string m_message;
+};
+
+#endif
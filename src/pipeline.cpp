@@ -0,0 +1,266 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Pipelined processing: the children of the document's root element are
+// parsed, indexed and written by three threads connected by bounded queues,
+// so that reading and writing the files overlaps with the indexing itself.
+//
+
+#include "auto_index.hpp"
+#include "bounded_queue.hpp"
+#include <boost/thread/thread.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace
+{
+   //
+   // A child of the root on its way to the writer, "held" children have to
+   // wait until the indexes have been generated:
+   //
+   struct pipeline_item
+   {
+      boost::tiny_xml::element_ptr node;
+      bool held;
+   };
+
+   typedef bounded_queue<boost::tiny_xml::element_ptr> parsed_queue;
+   typedef bounded_queue<pipeline_item> processed_queue;
+
+   void capture_exception(boost::exception_ptr& error)
+   {
+      try
+      {
+         throw;
+      }
+      catch(const std::string& s)
+      {
+         // tiny_xml reports syntax errors by throwing strings:
+         error = boost::copy_exception(s);
+      }
+      catch(...)
+      {
+         error = boost::current_exception();
+      }
+   }
+
+   struct parse_stage
+   {
+      boost::tiny_xml::child_parser* parser;
+      parsed_queue* out;
+      boost::exception_ptr* error;
+
+      void operator()()const
+      {
+         try
+         {
+            while(boost::tiny_xml::element_ptr child = parser->next())
+            {
+               if(!out->push(child))
+                  break;
+            }
+         }
+         catch(...)
+         {
+            capture_exception(*error);
+         }
+         out->close();
+      }
+   };
+
+   //
+   // When streaming, the root's start tag and each child go straight to the
+   // output, otherwise each child is serialized into the deferred buffer
+   // until we know what else has to go in front of it:
+   //
+   struct write_stage
+   {
+      processed_queue* in;
+      boost::tiny_xml::writer* out;
+      boost::tiny_xml::writer* deferred;
+      const boost::tiny_xml::element* root;
+      bool* started;
+      std::vector<boost::tiny_xml::element_ptr>* held;
+      boost::exception_ptr* error;
+
+      void operator()()const
+      {
+         try
+         {
+            pipeline_item item;
+            while(in->pop(item))
+            {
+               if(item.held || !held->empty())
+                  held->push_back(item.node);
+               else if(deferred)
+                  deferred->write(*item.node);
+               else
+               {
+                  if(!*started)
+                  {
+                     out->write_start(*root);
+                     *started = true;
+                  }
+                  out->write(*item.node);
+               }
+            }
+         }
+         catch(...)
+         {
+            capture_exception(*error);
+         }
+         in->close();
+      }
+   };
+
+   //
+   // Makes sure that the worker threads have finished with the queues before
+   // they go out of scope, however we leave:
+   //
+   struct pipeline_guard
+   {
+      parsed_queue& parsed;
+      processed_queue& processed;
+      boost::thread& parser;
+      boost::thread& writer;
+
+      ~pipeline_guard()
+      {
+         parsed.close();
+         processed.close();
+         if(parser.joinable())
+            parser.join();
+         if(writer.joinable())
+            writer.join();
+      }
+   };
+}
+
+void process_nodes_pipelined(std::istream& is, const std::string& header, const std::string& outfile, std::size_t queue_size)
+{
+   boost::tiny_xml::child_parser parser(is, "");
+   boost::tiny_xml::element_ptr root = parser.root();
+
+   if(should_flatten_node(root->name.c_str()) || (root->name == "indexterm") || (root->name.size() && (root->name[0] == '?')))
+   {
+      //
+      // The root is itself a block of text to index, there's nothing to pipeline:
+      //
+      while(boost::tiny_xml::element_ptr child = parser.next())
+         root->elements.push_back(child);
+      process_nodes(root);
+      if(internal_indexes)
+         generate_indexes();
+      boost::tiny_xml::writer os(outfile);
+      os.write(header + "\n");
+      os.write(*root);
+      os.flush();
+      return;
+   }
+
+   boost::tiny_xml::writer os(outfile);
+   os.write(header + "\n");
+   //
+   // If the root can contain <indexterm>s then indexing a later child may insert
+   // one in front of the first child, so we can't start writing the children
+   // until we're done, but can at least serialize them as we go, to a temporary
+   // file rather than memory with --memory-limit:
+   //
+   boost::scoped_ptr<deferred_output> deferred;
+   if(can_contain_indexterm(root->name.c_str()))
+      deferred.reset(new deferred_output(memory_limited()));
+
+   parsed_queue parsed(queue_size);
+   processed_queue processed(queue_size);
+   boost::exception_ptr parse_error, write_error;
+   bool started = false;
+   std::vector<boost::tiny_xml::element_ptr> held;
+
+   parse_stage p = { &parser, &parsed, &parse_error };
+   write_stage w = { &processed, &os, deferred ? &deferred->out() : 0, root.get(), &started, &held, &write_error };
+   boost::thread parse_thread(p);
+   boost::thread write_thread(w);
+   {
+      pipeline_guard guard = { parsed, processed, parse_thread, write_thread };
+      //
+      // Set up the scope of the root element just as process_nodes would:
+      //
+      node_id outer_id;
+      title_info outer_title;
+      node_id id(0, &outer_id);
+      if(can_contain_title(root->name.c_str()))
+         id.id = find_attr(root, "id");
+      title_info title("", &outer_title);
+      boost::tiny_xml::element* container = can_contain_indexterm(root->name.c_str()) ? root.get() : 0;
+      bool in_title = !container && (root->name == "title");
+
+      bool ignoring = false;
+      bool hold = false;
+      boost::tiny_xml::element_ptr child;
+      while(parsed.pop(child))
+      {
+         if(!ignoring)
+         {
+            std::size_t index_count = indexes.size();
+            //
+            // If an ignore processing instruction in this child applies to the root,
+            // then this is the last child we process:
+            //
+            ignore_kind k = ignored_from(child, ignored_content);
+            if(k != ignore_nothing)
+            {
+               if(!ignore_stops_at(k, root->name))
+                  report_unenclosed_ignore(k);
+               ignoring = true;
+            }
+            process_node(child, &id, &title, container, in_title, false);
+            //
+            // Anything containing an index has to wait until the index is generated,
+            // and so then does everything after it:
+            //
+            if(internal_indexes && (indexes.size() != index_count))
+               hold = true;
+         }
+         pipeline_item item = { child, hold };
+         if(!processed.push(item))
+            break;
+      }
+   }
+   if(parse_error)
+      boost::rethrow_exception(parse_error);
+   if(write_error)
+      boost::rethrow_exception(write_error);
+   bool have_deferred = deferred && !deferred->empty();
+
+   if(internal_indexes)
+      generate_indexes();
+   //
+   // Finish off whatever hasn't been written yet:
+   //
+   if(!started && held.empty() && !have_deferred)
+   {
+      // No children, so the root is written as an empty element, unless something got inserted into it:
+      os.write(*root);
+   }
+   else
+   {
+      if(!started)
+      {
+         os.write_start(*root);
+         // Any <indexterm>s inserted into the root go before all of the children:
+         for(boost::tiny_xml::element_list::const_iterator i = root->elements.begin(); i != root->elements.end(); ++i)
+            os.write(**i);
+         if(deferred)
+            deferred->copy_to(os);
+      }
+      for(std::vector<boost::tiny_xml::element_ptr>::const_iterator i = held.begin(); i != held.end(); ++i)
+         os.write(**i);
+      os.write_end(*root);
+   }
+   os.flush();
+}
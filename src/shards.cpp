@@ -0,0 +1,357 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Sharding: --shard=i/N indexes only the i'th of N contiguous runs of the
+// top level children of the document, and saves what indexing did - every
+// <indexterm> inserted and every index entry added - in the order it did it.
+// --merge then walks the whole document without indexing it (so that the
+// titles, ids and <index> elements are set up as usual), and replays the
+// shards in document order, which gives exactly what one process would have.
+//
+// Hits that --no-duplicates might suppress are recorded along with the block id
+// and term they were found under, so that a hit already seen by an earlier shard
+// is dropped when merging, just as it would have been when indexing in one go.
+//
+// The file layout follows that of compiled scripts (see pack_io.hpp):
+//
+//    char[8]   magic "AIDXSHRD"
+//    uint32    byte order check, 0x01020304
+//    uint32    version
+//    uint32    shard number i, uint32 number of shards N
+//    uint32    options: 1 = --internal-index, 2 = --no-duplicates
+//    uint32    number of elements in the document
+//    uint32    number of hits
+//    hits:     uint32 keyed, string block id, string term,
+//              uint32 number of indexterms, then for each:
+//                 uint32 container, string primary, string secondary,
+//                 string type, uint32 preferred
+//              uint32 number of entry chains, then for each:
+//                 uint32 length, then for each entry:
+//                    string key, string id, string category, uint32 preferred
+//
+// where each container is the number of the element in a pre-order walk of
+// the document as it was parsed.
+//
+
+#include "auto_index.hpp"
+#include "pack_io.hpp"
+#include <algorithm>
+#include <iterator>
+
+bool sharding = false;
+
+namespace
+{
+   const char shard_magic[8] = { 'A', 'I', 'D', 'X', 'S', 'H', 'R', 'D' };
+   const boost::uint32_t shard_byte_order = 0x01020304u;
+   const boost::uint32_t shard_version = 1;
+   const boost::uint32_t option_internal_index = 1;
+   const boost::uint32_t option_no_duplicates = 2;
+
+   enum shard_mode
+   {
+      no_shards,
+      writing_shard,
+      merging_shards
+   };
+   shard_mode mode = no_shards;
+   unsigned this_shard, shard_count;
+
+   struct shard_indexterm
+   {
+      boost::uint32_t container;
+      std::string primary, secondary, type;
+      bool preferred;
+   };
+   struct shard_entry
+   {
+      std::string key, id, category;
+      bool preferred;
+   };
+   struct shard_hit
+   {
+      bool keyed;
+      std::string id, term;
+      std::vector<shard_indexterm> indexterms;
+      std::vector<std::vector<shard_entry> > entries;
+   };
+   std::vector<shard_hit> hits;
+   // The (block id, term) pairs indexed so far while merging, with --no-duplicates:
+   boost::unordered_set<std::pair<interned_string, interned_string> > merged_terms;
+   boost::unordered_map<const boost::tiny_xml::element*, boost::uint32_t> element_numbers;
+   boost::uint32_t element_count;
+
+   //
+   // Numbers the elements of the document in pre-order:
+   //
+   template <class F>
+   void number_elements(const boost::tiny_xml::element_ptr& root, F f)
+   {
+      typedef std::pair<const boost::tiny_xml::element*, boost::tiny_xml::element_list::const_iterator> frame;
+      boost::uint32_t n = 0;
+      f(root.get(), n++);
+      std::vector<frame> stack(1, frame(root.get(), root->elements.begin()));
+      while(!stack.empty())
+      {
+         frame& fr = stack.back();
+         if(fr.second == fr.first->elements.end())
+            stack.pop_back();
+         else
+         {
+            const boost::tiny_xml::element* child = (fr.second++)->get();
+            f(child, n++);
+            stack.push_back(frame(child, child->elements.begin()));
+         }
+      }
+      element_count = n;
+   }
+   struct record_number
+   {
+      void operator()(const boost::tiny_xml::element* e, boost::uint32_t n)const { element_numbers[e] = n; }
+   };
+   struct collect_elements
+   {
+      std::vector<boost::tiny_xml::element*>* elements;
+      void operator()(const boost::tiny_xml::element* e, boost::uint32_t)const { elements->push_back(const_cast<boost::tiny_xml::element*>(e)); }
+   };
+
+   boost::uint32_t current_options()
+   {
+      return (internal_indexes ? option_internal_index : 0) | (no_duplicates ? option_no_duplicates : 0);
+   }
+
+   void write_entry(std::ostream& os, const shard_entry& e)
+   {
+      write_string(os, e.key);
+      write_string(os, e.id);
+      write_string(os, e.category);
+      write_u32(os, e.preferred ? 1 : 0);
+   }
+
+   //
+   // A shard file loaded for merging:
+   //
+   struct shard_file
+   {
+      std::string name;
+      std::string data;
+      unsigned index;
+   };
+   bool operator < (const shard_file& a, const shard_file& b)
+   {
+      return a.index < b.index;
+   }
+
+   void replay_shard(const shard_file& file, const std::vector<boost::tiny_xml::element*>& elements)
+   {
+      pack_reader reader(file.data.data(), file.data.size(), file.name, "Shard file is truncated or corrupt: ");
+      reader.read_bytes(sizeof(shard_magic) + 6 * sizeof(boost::uint32_t));
+      boost::uint32_t hit_count = reader.read_u32();
+      for(boost::uint32_t h = 0; h < hit_count; ++h)
+      {
+         bool keyed = reader.read_u32() != 0;
+         interned_string id(reader.read_string());
+         interned_string term(reader.read_string());
+         bool wanted = true;
+         if(keyed && no_duplicates)
+            wanted = merged_terms.insert(std::make_pair(id, term)).second;
+         boost::uint32_t indexterm_count = reader.read_u32();
+         for(boost::uint32_t i = 0; i < indexterm_count; ++i)
+         {
+            boost::uint32_t container = reader.read_u32();
+            std::string primary = reader.read_string();
+            std::string secondary = reader.read_string();
+            std::string type = reader.read_string();
+            bool preferred = reader.read_u32() != 0;
+            if(container >= elements.size())
+               reader.corrupt();
+            if(wanted)
+               insert_indexterm(elements[container], primary, secondary, type, preferred);
+         }
+         boost::uint32_t chain_count = reader.read_u32();
+         for(boost::uint32_t i = 0; i < chain_count; ++i)
+         {
+            boost::uint32_t length = reader.read_u32();
+            if(length > 4)
+               reader.corrupt();  // Primary, secondary, tertiary and the block.
+            std::vector<index_entry_ptr> chain(length);
+            for(std::vector<index_entry_ptr>::iterator e = chain.begin(); e != chain.end(); ++e)
+            {
+               interned_string key(reader.read_string());
+               interned_string eid(reader.read_string());
+               interned_string category(reader.read_string());
+               e->reset(new index_entry(key, eid, category));
+               (*e)->preferred = reader.read_u32() != 0;
+            }
+            if(wanted && chain.size())
+               insert_index_entries(&chain[0], &chain[0] + chain.size());
+         }
+      }
+      if(!reader.at_end())
+         reader.corrupt();
+   }
+}
+
+void begin_shard(const boost::tiny_xml::element_ptr& root, unsigned index, unsigned count)
+{
+   if(!count || !index || (index > count))
+      throw std::runtime_error("The shard to process must be given as i/N, where i is between 1 and N.");
+   mode = writing_shard;
+   this_shard = index;
+   shard_count = count;
+   sharding = true;
+   number_elements(root, record_number());
+}
+
+void begin_merge()
+{
+   mode = merging_shards;
+}
+
+bool indexes_document_root()
+{
+   // The root itself goes with the first shard:
+   return (mode == no_shards) || ((mode == writing_shard) && (this_shard == 1));
+}
+
+bool indexes_top_level_child(std::size_t child, std::size_t children)
+{
+   if(mode == no_shards)
+      return true;
+   if(mode == merging_shards)
+      return false;
+   boost::uintmax_t first = static_cast<boost::uintmax_t>(children) * (this_shard - 1) / shard_count;
+   boost::uintmax_t last = static_cast<boost::uintmax_t>(children) * this_shard / shard_count;
+   return (child >= first) && (child < last);
+}
+
+void record_hit(const interned_string& id, const interned_string& term)
+{
+   hits.push_back(shard_hit());
+   hits.back().keyed = true;
+   hits.back().id = id.str();
+   hits.back().term = term.str();
+}
+
+void record_manual_entry()
+{
+   hits.push_back(shard_hit());
+   hits.back().keyed = false;
+}
+
+void record_indexterm(const boost::tiny_xml::element* container, const std::string& primary, const std::string& secondary, const std::string& type, bool preferred)
+{
+   shard_indexterm t;
+   t.container = element_numbers[container];
+   t.primary = primary;
+   t.secondary = secondary;
+   t.type = type;
+   t.preferred = preferred;
+   hits.back().indexterms.push_back(t);
+}
+
+void record_index_entries(const index_entry_ptr* first, const index_entry_ptr* last)
+{
+   std::vector<shard_entry> chain;
+   for(; first != last; ++first)
+   {
+      shard_entry e;
+      e.key = (*first)->key.str();
+      e.id = (*first)->id.str();
+      e.category = (*first)->category.str();
+      e.preferred = (*first)->preferred;
+      chain.push_back(e);
+   }
+   hits.back().entries.push_back(chain);
+}
+
+void save_shard(const std::string& file)
+{
+   std::ofstream os(file.c_str(), std::ios_base::binary);
+   if(!os.good())
+      throw std::runtime_error("Could not create shard file: " + file);
+   os.write(shard_magic, sizeof(shard_magic));
+   write_u32(os, shard_byte_order);
+   write_u32(os, shard_version);
+   write_u32(os, this_shard);
+   write_u32(os, shard_count);
+   write_u32(os, current_options());
+   write_u32(os, element_count);
+   write_u32(os, static_cast<boost::uint32_t>(hits.size()));
+   for(std::vector<shard_hit>::const_iterator h = hits.begin(); h != hits.end(); ++h)
+   {
+      write_u32(os, h->keyed ? 1 : 0);
+      write_string(os, h->id);
+      write_string(os, h->term);
+      write_u32(os, static_cast<boost::uint32_t>(h->indexterms.size()));
+      for(std::vector<shard_indexterm>::const_iterator t = h->indexterms.begin(); t != h->indexterms.end(); ++t)
+      {
+         write_u32(os, t->container);
+         write_string(os, t->primary);
+         write_string(os, t->secondary);
+         write_string(os, t->type);
+         write_u32(os, t->preferred ? 1 : 0);
+      }
+      write_u32(os, static_cast<boost::uint32_t>(h->entries.size()));
+      for(std::vector<std::vector<shard_entry> >::const_iterator c = h->entries.begin(); c != h->entries.end(); ++c)
+      {
+         write_u32(os, static_cast<boost::uint32_t>(c->size()));
+         for(std::vector<shard_entry>::const_iterator e = c->begin(); e != c->end(); ++e)
+            write_entry(os, *e);
+      }
+   }
+   if(!os.good())
+      throw std::runtime_error("Error writing shard file: " + file);
+   std::cout << "Wrote shard " << this_shard << " of " << shard_count << ", with " << hits.size() << " index hits, to " << file << std::endl;
+}
+
+void merge_shards(const boost::tiny_xml::element_ptr& root, const std::vector<std::string>& files)
+{
+   std::vector<boost::tiny_xml::element*> elements;
+   collect_elements c = { &elements };
+   number_elements(root, c);
+
+   std::vector<shard_file> shards(files.size());
+   unsigned count = 0;
+   for(std::size_t i = 0; i < files.size(); ++i)
+   {
+      shard_file& s = shards[i];
+      s.name = files[i];
+      std::ifstream is(s.name.c_str(), std::ios_base::binary);
+      if(!is.good())
+         throw std::runtime_error("Unable to read from shard file: " + s.name);
+      s.data.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+
+      pack_reader reader(s.data.data(), s.data.size(), s.name, "Shard file is truncated or corrupt: ");
+      if(std::memcmp(reader.read_bytes(sizeof(shard_magic)), shard_magic, sizeof(shard_magic)))
+         throw std::runtime_error("Not a shard file: " + s.name);
+      if(reader.read_u32() != shard_byte_order)
+         throw std::runtime_error("Shard file was created on a machine with a different byte order: " + s.name);
+      if(reader.read_u32() != shard_version)
+         throw std::runtime_error("Shard file was created by an incompatible version of AutoIndex: " + s.name);
+      s.index = reader.read_u32();
+      unsigned n = reader.read_u32();
+      if(i && (n != count))
+         throw std::runtime_error("Shard file " + s.name + " belongs to a different set of shards to " + shards[0].name);
+      count = n;
+      if(reader.read_u32() != current_options())
+         throw std::runtime_error("Shard file was created with different --internal-index or --no-duplicates options: " + s.name);
+      if(reader.read_u32() != elements.size())
+         throw std::runtime_error("Shard file was created from a different document: " + s.name);
+   }
+   std::sort(shards.begin(), shards.end());
+   if(shards.size() != count)
+      throw std::runtime_error("All of the shards of the document are needed to merge them.");
+   for(std::size_t i = 0; i < shards.size(); ++i)
+   {
+      if(shards[i].index != i + 1)
+         throw std::runtime_error("All of the shards of the document are needed to merge them.");
+   }
+   for(std::vector<shard_file>::const_iterator s = shards.begin(); s != shards.end(); ++s)
+      replay_shard(*s, elements);
+}
@@ -0,0 +1,215 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Keeping within --memory-limit: once the index entries are estimated to be
+// using more than the limit, they're saved to a temporary entry file (a "run",
+// sorted just as the entries are) and dropped.  The runs are merged with the
+// entries still in memory, in the order they were written: an entry that's
+// already present keeps its id and flags but gains any new sub-keys, just as it
+// does when it's inserted into index_entries, so the result is exactly the same
+// as if nothing had been spilled.
+//
+// generate_indexes steps through the merged entries with index_entry_merger,
+// one top level entry at a time, so the whole set is never in memory at once.
+// Only --save-entries and --export-index merge all the runs back into memory.
+//
+
+#include "auto_index.hpp"
+
+namespace
+{
+   //
+   // Each entry costs its node in the parent's set, the entry itself and the
+   // shared_ptr count, plus the allocator's overhead for each, its strings
+   // are pooled and don't count:
+   //
+   const std::size_t entry_overhead = sizeof(index_entry) + 4 * sizeof(void*) + sizeof(index_entry_ptr) + 2 * sizeof(long) + 3 * 16;
+
+   boost::uintmax_t memory_limit = 0;
+   boost::uintmax_t entry_bytes = 0;
+   std::vector<std::string> spilled_runs;
+
+   //
+   // Removes any temporary files we leave behind, however we exit:
+   //
+   struct spill_files
+   {
+      std::set<std::string> names;
+
+      ~spill_files()
+      {
+         for(std::set<std::string>::const_iterator i = names.begin(); i != names.end(); ++i)
+         {
+            boost::system::error_code ec;
+            boost::filesystem::remove(*i, ec);
+         }
+      }
+   } temporary_files;
+}
+
+void set_memory_limit(boost::uintmax_t bytes)
+{
+   memory_limit = bytes;
+}
+
+bool memory_limited()
+{
+   return memory_limit != 0;
+}
+
+std::string create_spill_file()
+{
+   boost::filesystem::path p = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("auto_index-%%%%-%%%%-%%%%.tmp");
+   temporary_files.names.insert(p.string());
+   return p.string();
+}
+
+void remove_spill_file(const std::string& name)
+{
+   boost::system::error_code ec;
+   boost::filesystem::remove(name, ec);
+   temporary_files.names.erase(name);
+}
+
+void note_index_entries_added(std::size_t count)
+{
+   entry_bytes += count * entry_overhead;
+   if(memory_limit && (entry_bytes > memory_limit))
+   {
+      std::string run = create_spill_file();
+      if(verbose)
+         std::cout << "Spilling " << index_entries.size() << " top level index entries to " << run << std::endl;
+      save_index_entries(index_entries, run);
+      spilled_runs.push_back(run);
+      index_entries.clear();
+      entry_bytes = 0;
+   }
+}
+
+void merge_spilled_index_entries()
+{
+   if(spilled_runs.empty())
+      return;
+   index_entry_set merged;
+   for(std::vector<std::string>::const_iterator i = spilled_runs.begin(); i != spilled_runs.end(); ++i)
+   {
+      load_index_entries(*i, merged);
+      remove_spill_file(*i);
+   }
+   merge_index_entries(merged, index_entries);
+   index_entries.swap(merged);
+   if(verbose)
+      std::cout << "Merged " << spilled_runs.size() << " spilled runs of index entries" << std::endl;
+   spilled_runs.clear();
+}
+
+bool have_spilled_index_entries()
+{
+   return !spilled_runs.empty();
+}
+
+std::size_t count_index_entries()
+{
+   if(spilled_runs.empty())
+      return index_entries.size();
+   std::size_t count = 0;
+   index_entry_merger merger;
+   index_entry_ptr e;
+   while(merger.next(e, true))
+      ++count;
+   return count;
+}
+
+index_entry_merger::index_entry_merger() : m_memory(index_entries.begin())
+{
+   for(std::vector<std::string>::const_iterator i = spilled_runs.begin(); i != spilled_runs.end(); ++i)
+      m_runs.push_back(boost::shared_ptr<entry_file_reader>(new entry_file_reader(*i)));
+}
+
+bool index_entry_merger::next(index_entry_ptr& e, bool keys_only)
+{
+   //
+   // Find the lowest key, the runs are searched first, in the order they were
+   // written, so that the earliest entry for the key is the one that's kept:
+   //
+   const index_entry_ptr* lowest = 0;
+   for(std::vector<boost::shared_ptr<entry_file_reader> >::const_iterator i = m_runs.begin(); i != m_runs.end(); ++i)
+   {
+      if(!(*i)->at_end() && (!lowest || ((*i)->front() < *lowest)))
+         lowest = &(*i)->front();
+   }
+   if((m_memory != index_entries.end()) && (!lowest || (*m_memory < *lowest)))
+      lowest = &*m_memory;
+   if(!lowest)
+      return false;
+   const index_entry_ptr key = *lowest;
+   //
+   // Then merge every source's entry for it, in that same order:
+   //
+   index_entry_set merged;
+   for(std::vector<boost::shared_ptr<entry_file_reader> >::const_iterator i = m_runs.begin(); i != m_runs.end(); ++i)
+   {
+      if((*i)->at_end() || (key < (*i)->front()))
+         continue;
+      if(keys_only)
+         (*i)->skip();
+      else
+         (*i)->pop(merged);
+   }
+   if((m_memory != index_entries.end()) && !(key < *m_memory))
+   {
+      if(!keys_only)
+      {
+         index_entry_set last;
+         last.insert(*m_memory);
+         merge_index_entries(merged, last);
+      }
+      ++m_memory;
+   }
+   e = keys_only ? key : *merged.begin();
+   return true;
+}
+
+deferred_output::deferred_output(bool spill) : m_stream(&m_memory)
+{
+   if(spill)
+   {
+      m_file_name = create_spill_file();
+      m_file.open(m_file_name.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      if(!m_file.good())
+         throw std::runtime_error("Unable to create temporary file " + m_file_name);
+      m_stream = &m_file;
+   }
+   m_writer.reset(new boost::tiny_xml::writer(*m_stream));
+}
+
+deferred_output::~deferred_output()
+{
+   m_writer.reset();
+   if(m_file_name.size())
+   {
+      m_file.close();
+      remove_spill_file(m_file_name);
+   }
+}
+
+bool deferred_output::empty()
+{
+   m_writer->flush();
+   return m_stream->tellp() <= 0;
+}
+
+void deferred_output::copy_to(boost::tiny_xml::writer& os)
+{
+   m_writer->flush();
+   // Read back a piece at a time, rather than making a copy of it all:
+   m_stream->seekg(0);
+   std::vector<char> buffer(64 * 1024);
+   while(m_stream->read(&buffer[0], buffer.size()) || m_stream->gcount())
+      os.write(&buffer[0], static_cast<std::size_t>(m_stream->gcount()));
+}
@@ -0,0 +1,297 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Streamed processing, used when the <indexterm>s go in the document rather
+// than an internal index: only the sections we're in the middle of are kept
+// open, everything else is parsed, indexed, serialized and released a child
+// at a time, so that the whole document is never in memory at once.
+//
+// The <indexterm>s found while indexing a child go in front of the first
+// child of its nearest container, so the children of a section that can
+// contain them are serialized into a buffer, and only written out behind the
+// section's start tag and <indexterm>s once the section is done.  Sections
+// that can't contain <indexterm>s go straight through to the enclosing buffer,
+// or the output file.
+//
+// There's one buffer for each outermost section that can contain <indexterm>s,
+// which those nested inside it share: each leaves a gap for its start tag and
+// <indexterm>s that's filled in once it's done.  So each child is serialized
+// and copied just once, however deeply the sections are nested.
+//
+
+#include "auto_index.hpp"
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <list>
+
+namespace
+{
+   class held_children : private boost::noncopyable
+   {
+      struct held_text
+      {
+         std::string text;
+         bool open;                                // A gap that's still to be filled in.
+
+         held_text(const std::string& t, bool o) : text(t), open(o) {}
+      };
+   public:
+      struct gap
+      {
+         std::list<held_text>::iterator pos;
+         std::size_t held;                         // How much had been held when it was made.
+      };
+
+      explicit held_children(bool spill) : m_done(spill), m_writer(m_tail, tail_flush_size), m_held(0) {}
+
+      // Where the children go now:
+      boost::tiny_xml::writer& out()
+      {
+         return m_text.empty() ? m_done.out() : m_writer;
+      }
+      // Leaves a gap for the start tag and <indexterm>s of a nested section:
+      gap open()
+      {
+         end_text();
+         gap g;
+         g.pos = m_text.insert(m_text.end(), held_text(std::string(), true));
+         g.held = m_held;
+         return g;
+      }
+      // Fills in the gap for e, now that its children are done:
+      void close(const gap& g, const boost::tiny_xml::element& e)
+      {
+         end_text();
+         bool children = m_held != g.held;
+         if(children || !e.elements.empty())
+         {
+            m_writer.write_start(e);
+            // Any <indexterm>s inserted go before all of the children:
+            for(boost::tiny_xml::element_list::const_iterator i = e.elements.begin(); i != e.elements.end(); ++i)
+               m_writer.write(**i);
+         }
+         else
+         {
+            // No children, so it's written as an empty element:
+            m_writer.write(e);
+         }
+         m_writer.flush();
+         g.pos->text = m_tail.str();
+         g.pos->open = false;
+         m_held += g.pos->text.size();
+         m_tail.str(std::string());
+         //
+         // Everything in front of the first gap still open can go now:
+         //
+         while(!m_text.empty() && !m_text.front().open)
+         {
+            m_done.out().write(m_text.front().text);
+            m_text.pop_front();
+         }
+         if(children || !e.elements.empty())
+            out().write_end(e);
+      }
+      bool empty() { return m_done.empty(); }
+      void copy_to(boost::tiny_xml::writer& os) { m_done.copy_to(os); }
+   private:
+      static const std::size_t tail_flush_size = 64 * 1024;
+
+      // Moves whatever's been written since the last gap into the list:
+      void end_text()
+      {
+         if(m_text.empty())
+            return;
+         m_writer.flush();
+         std::string text = m_tail.str();
+         if(text.size())
+         {
+            m_held += text.size();
+            m_text.push_back(held_text(text, false));
+            m_tail.str(std::string());
+         }
+      }
+
+      deferred_output m_done;                      // Everything in front of the first gap.
+      std::ostringstream m_tail;                   // Whatever's been written since the last gap.
+      boost::tiny_xml::writer m_writer;            // Writes to m_tail.
+      std::list<held_text> m_text;                 // The text and gaps from the first gap on.
+      std::size_t m_held;                          // How much text has gone into m_text.
+   };
+
+   struct open_element
+   {
+      boost::tiny_xml::element_ptr node;
+      node_id id;
+      title_info title;
+      boost::tiny_xml::element* container;         // For the children, as in process_node.
+      bool in_title;                               // Likewise.
+      bool ignoring;                               // Processing stopped by an ignore processing instruction.
+      bool started;                                // The start tag has been written to out.
+      boost::tiny_xml::writer* out;                // Where the element goes.
+      boost::shared_ptr<held_children> children;   // Where the children go if it's the outermost container.
+      held_children* held;                         // The buffer of the outermost container it's in, if any.
+      bool has_gap;                                // It's a container inside another, with a gap in held.
+      held_children::gap gap;
+   };
+
+   //
+   // Sections are kept open, unless they're a block of text to index as a whole:
+   //
+   bool opens(const std::string& name)
+   {
+      return is_section(name) && !should_flatten_node(name.c_str());
+   }
+
+   boost::tiny_xml::writer& children_out(open_element& e)
+   {
+      if(e.has_gap)
+         return e.held->out();
+      if(e.children)
+         return e.children->out();
+      if(!e.started)
+      {
+         e.out->write_start(*e.node);
+         e.started = true;
+      }
+      return *e.out;
+   }
+
+   void close(open_element& e)
+   {
+      if(e.has_gap)
+         e.held->close(e.gap, *e.node);
+      else if(e.children && (!e.children->empty() || !e.node->elements.empty()))
+      {
+         e.out->write_start(*e.node);
+         // Any <indexterm>s inserted go before all of the children:
+         for(boost::tiny_xml::element_list::const_iterator i = e.node->elements.begin(); i != e.node->elements.end(); ++i)
+            e.out->write(**i);
+         e.children->copy_to(*e.out);
+         e.out->write_end(*e.node);
+      }
+      else if(e.started)
+         e.out->write_end(*e.node);
+      else
+      {
+         // No children, so it's written as an empty element:
+         e.out->write(*e.node);
+      }
+   }
+}
+
+void process_nodes_streamed(std::istream& is, const std::string& header, const std::string& outfile)
+{
+   boost::tiny_xml::child_parser parser(is, "");
+   boost::tiny_xml::element_ptr root = parser.root();
+
+   if(!parser.depth() || should_flatten_node(root->name.c_str()) || (root->name == "indexterm") || (root->name.size() && (root->name[0] == '?')))
+   {
+      //
+      // The root is empty, or is itself a block of text to index, there's
+      // nothing to stream:
+      //
+      while(boost::tiny_xml::element_ptr child = parser.next())
+         root->elements.push_back(child);
+      process_nodes(root);
+      boost::tiny_xml::writer os(outfile);
+      os.write(header + "\n");
+      os.write(*root);
+      os.flush();
+      return;
+   }
+
+   boost::tiny_xml::writer os(outfile);
+   os.write(header + "\n");
+   //
+   // Set up the scope of the root element just as process_nodes would, the
+   // deque keeps the scopes where they are as sections are opened and closed:
+   //
+   node_id outer_id;
+   title_info outer_title;
+   std::deque<open_element> stack(1);
+   {
+      open_element& e = stack.back();
+      e.node = root;
+      e.id.id = can_contain_title(root->name.c_str()) ? find_attr(root, "id") : 0;
+      e.id.prev = &outer_id;
+      e.title.prev = &outer_title;
+      e.container = can_contain_indexterm(root->name.c_str()) ? root.get() : 0;
+      e.in_title = !e.container && (root->name == "title");
+      e.ignoring = false;
+      e.started = false;
+      e.out = &os;
+      if(e.container)
+         e.children.reset(new held_children(memory_limited()));
+      e.held = e.children.get();
+      e.has_gap = false;
+   }
+
+   while(!stack.empty())
+   {
+      open_element& f = stack.back();
+      std::size_t depth = parser.depth();
+      boost::tiny_xml::element_ptr child = parser.next(f.ignoring ? 0 : &opens);
+      if(!child)
+      {
+         close(f);
+         stack.pop_back();
+      }
+      else if(parser.depth() > depth)
+      {
+         //
+         // A section: its scope is set up just as enter_node would, and it
+         // stays open until its end tag:
+         //
+         boost::tiny_xml::writer& out = children_out(f);
+         stack.push_back(open_element());
+         open_element& e = stack.back();
+         open_element& parent = stack[stack.size() - 2];
+         e.node = child;
+         e.id.id = can_contain_title(child->name.c_str()) ? find_attr(child, "id") : 0;
+         e.id.prev = &parent.id;
+         e.title.prev = &parent.title;
+         e.container = can_contain_indexterm(child->name.c_str()) ? child.get() : parent.container;
+         e.in_title = (e.container == child.get()) ? false : parent.in_title;
+         e.ignoring = false;
+         e.started = false;
+         e.out = &out;
+         e.held = parent.held;
+         e.has_gap = (e.container == child.get()) && e.held;
+         if(e.has_gap)
+            e.gap = e.held->open();
+         else if(e.container == child.get())
+         {
+            // With --memory-limit this buffer goes to a temporary file:
+            e.children.reset(new held_children(memory_limited()));
+            e.held = e.children.get();
+         }
+      }
+      else
+      {
+         if(!f.ignoring)
+         {
+            //
+            // If an ignore processing instruction in this child applies to us,
+            // then this is the last child we process:
+            //
+            ignore_kind k = ignored_from(child, ignored_content);
+            if(k != ignore_nothing)
+            {
+               if(!ignore_stops_at(k, f.node->name))
+                  report_unenclosed_ignore(k);
+               f.ignoring = true;
+            }
+            process_node(child, &f.id, &f.title, f.container, f.in_title, false);
+            // The child is about to go, and its elements with it:
+            ignored_content.clear();
+         }
+         children_out(f).write(*child);
+      }
+   }
+   os.flush();
+}
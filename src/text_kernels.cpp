@@ -0,0 +1,286 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include "text_kernels.hpp"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#  define AUTO_INDEX_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+namespace
+{
+   //
+   // Each kernel returns the offset of the first byte of interest in [p, p+n),
+   // or n if there isn't one:
+   //
+   typedef std::size_t (*scan_kernel)(const char* p, std::size_t n);
+
+   struct kernel_table
+   {
+      simd_level level;
+      scan_kernel find_escape;      // first of & < > "
+      scan_kernel find_non_space;   // first character that isn't [[:space:]]
+   };
+
+   inline bool is_escape_char(char c)
+   {
+      return (c == '&') || (c == '<') || (c == '>') || (c == '"');
+   }
+   inline bool is_space_char(char c)
+   {
+      // The [[:space:]] class in the "C" locale: \t \n \v \f \r and space.
+      return (c == ' ') || ((static_cast<unsigned char>(c) >= 9) && (static_cast<unsigned char>(c) <= 13));
+   }
+
+   std::size_t find_escape_scalar(const char* p, std::size_t n)
+   {
+      for(std::size_t i = 0; i < n; ++i)
+      {
+         if(is_escape_char(p[i]))
+            return i;
+      }
+      return n;
+   }
+   std::size_t find_non_space_scalar(const char* p, std::size_t n)
+   {
+      for(std::size_t i = 0; i < n; ++i)
+      {
+         if(!is_space_char(p[i]))
+            return i;
+      }
+      return n;
+   }
+
+   const kernel_table scalar_kernels = { simd_scalar, find_escape_scalar, find_non_space_scalar };
+
+#ifdef AUTO_INDEX_X86_SIMD
+
+   __attribute__((target("sse2"))) std::size_t find_escape_sse2(const char* p, std::size_t n)
+   {
+      const __m128i amp = _mm_set1_epi8('&');
+      const __m128i lt = _mm_set1_epi8('<');
+      const __m128i gt = _mm_set1_epi8('>');
+      const __m128i quot = _mm_set1_epi8('"');
+      std::size_t i = 0;
+      for(; i + 16 <= n; i += 16)
+      {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+         __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot)));
+         unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+         if(mask)
+            return i + __builtin_ctz(mask);
+      }
+      return i + find_escape_scalar(p + i, n - i);
+   }
+   __attribute__((target("sse2"))) std::size_t find_non_space_sse2(const char* p, std::size_t n)
+   {
+      const __m128i space = _mm_set1_epi8(' ');
+      const __m128i tab = _mm_set1_epi8(9);
+      const __m128i range = _mm_set1_epi8(4);
+      std::size_t i = 0;
+      for(; i + 16 <= n; i += 16)
+      {
+         __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+         // \t to \r are the bytes where (v - 9) is at most 4 unsigned:
+         __m128i d = _mm_sub_epi8(v, tab);
+         __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(_mm_min_epu8(d, range), d));
+         unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m)) ^ 0xFFFFu;
+         if(mask)
+            return i + __builtin_ctz(mask);
+      }
+      return i + find_non_space_scalar(p + i, n - i);
+   }
+
+   const kernel_table sse2_kernels = { simd_sse2, find_escape_sse2, find_non_space_sse2 };
+
+   __attribute__((target("avx2"))) std::size_t find_escape_avx2(const char* p, std::size_t n)
+   {
+      const __m256i amp = _mm256_set1_epi8('&');
+      const __m256i lt = _mm256_set1_epi8('<');
+      const __m256i gt = _mm256_set1_epi8('>');
+      const __m256i quot = _mm256_set1_epi8('"');
+      std::size_t i = 0;
+      for(; i + 32 <= n; i += 32)
+      {
+         __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+         __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, lt)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, gt), _mm256_cmpeq_epi8(v, quot)));
+         unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(m));
+         if(mask)
+            return i + __builtin_ctz(mask);
+      }
+      // The tail is done here rather than by the SSE2 version, as calling legacy SSE
+      // code with the upper halves of the registers in use is very slow:
+      for(; i < n; ++i)
+      {
+         if(is_escape_char(p[i]))
+            return i;
+      }
+      return n;
+   }
+   __attribute__((target("avx2"))) std::size_t find_non_space_avx2(const char* p, std::size_t n)
+   {
+      const __m256i space = _mm256_set1_epi8(' ');
+      const __m256i tab = _mm256_set1_epi8(9);
+      const __m256i range = _mm256_set1_epi8(4);
+      std::size_t i = 0;
+      for(; i + 32 <= n; i += 32)
+      {
+         __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+         __m256i d = _mm256_sub_epi8(v, tab);
+         __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(_mm256_min_epu8(d, range), d));
+         unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(m));
+         if(mask)
+            return i + __builtin_ctz(mask);
+      }
+      for(; i < n; ++i)
+      {
+         if(!is_space_char(p[i]))
+            return i;
+      }
+      return n;
+   }
+
+   const kernel_table avx2_kernels = { simd_avx2, find_escape_avx2, find_non_space_avx2 };
+
+#endif
+
+   simd_level detect_simd_level()
+   {
+#ifdef AUTO_INDEX_X86_SIMD
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx2"))
+         return simd_avx2;
+      if(__builtin_cpu_supports("sse2"))
+         return simd_sse2;
+#endif
+      return simd_scalar;
+   }
+
+   const kernel_table* kernels_for(simd_level level)
+   {
+      if(level > max_simd_level())
+         level = max_simd_level();
+#ifdef AUTO_INDEX_X86_SIMD
+      if(level == simd_avx2)
+         return &avx2_kernels;
+      if(level == simd_sse2)
+         return &sse2_kernels;
+#endif
+      return &scalar_kernels;
+   }
+
+   const kernel_table*& active_kernels()
+   {
+      static const kernel_table* k = kernels_for(max_simd_level());
+      return k;
+   }
+}
+
+simd_level max_simd_level()
+{
+   static const simd_level level = detect_simd_level();
+   return level;
+}
+
+simd_level current_simd_level()
+{
+   return active_kernels()->level;
+}
+
+void use_simd_level(simd_level level)
+{
+   active_kernels() = kernels_for(level);
+}
+
+std::string escape_to_xml(const std::string& in)
+{
+   const char* p = in.data();
+   const std::size_t n = in.size();
+   scan_kernel find_escape = active_kernels()->find_escape;
+   std::size_t pos = find_escape(p, n);
+   if(pos == n)
+      return in;
+   std::string result;
+   result.reserve(n + n / 8 + 8);
+   std::size_t start = 0;
+   while(true)
+   {
+      result.append(p + start, pos - start);
+      if(pos == n)
+         break;
+      switch(p[pos])
+      {
+      case '&':
+         result.append("&amp;");
+         break;
+      case '<':
+         result.append("&lt;");
+         break;
+      case '>':
+         result.append("&gt;");
+         break;
+      default:
+         result.append("&quot;");
+         break;
+      }
+      start = pos + 1;
+      pos = start + find_escape(p + start, n - start);
+   }
+   return result;
+}
+
+std::string unescape_xml(const std::string& in)
+{
+   // memchr is already vectorised by the C library, so there's no kernel for this one:
+   const char* p = in.data();
+   const std::size_t n = in.size();
+   const char* amp = static_cast<const char*>(std::memchr(p, '&', n));
+   if(!amp)
+      return in;
+   static const struct { const char* name; std::size_t size; char c; } entities[] =
+   {
+      { "&quot;", 6, '"' },
+      { "&amp;", 5, '&' },
+      { "&apos;", 6, '\'' },
+      { "&lt;", 4, '<' },
+      { "&gt;", 4, '>' },
+   };
+   std::string result;
+   result.reserve(n);
+   const char* start = p;
+   const char* end = p + n;
+   while(amp)
+   {
+      result.append(start, amp);
+      start = amp + 1;
+      char c = '&';
+      for(unsigned i = 0; i < sizeof(entities) / sizeof(entities[0]); ++i)
+      {
+         if((static_cast<std::size_t>(end - amp) >= entities[i].size) && (std::memcmp(amp, entities[i].name, entities[i].size) == 0))
+         {
+            c = entities[i].c;
+            start = amp + entities[i].size;
+            break;
+         }
+      }
+      result.append(1, c);
+      amp = static_cast<const char*>(std::memchr(start, '&', end - start));
+   }
+   result.append(start, end);
+   return result;
+}
+
+bool is_whitespace(const std::string& in)
+{
+   return active_kernels()->find_non_space(in.data(), in.size()) == in.size();
+}
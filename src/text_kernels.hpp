@@ -0,0 +1,35 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef BOOST_AUTO_INDEX_TEXT_KERNELS_HPP
+#define BOOST_AUTO_INDEX_TEXT_KERNELS_HPP
+
+#include <string>
+
+//
+// Text helpers that get called on every block of text we index.  Each scans
+// for the bytes it's interested in 16 or 32 at a time where the processor allows,
+// and copies the spans in between in bulk.  The best version the processor
+// supports is selected the first time any of them is used:
+//
+std::string escape_to_xml(const std::string& in);    // & < > and " to entities
+std::string unescape_xml(const std::string& in);     // The reverse, plus &apos;
+bool is_whitespace(const std::string& in);           // True if every character is [[:space:]]
+
+enum simd_level
+{
+   simd_scalar,
+   simd_sse2,
+   simd_avx2
+};
+// The best level the processor supports, and the one currently in use:
+simd_level max_simd_level();
+simd_level current_simd_level();
+// Uses level, or the best supported below it, from now on: for testing.
+void use_simd_level(simd_level level);
+
+#endif
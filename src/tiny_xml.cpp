@@ -5,8 +5,15 @@
 //  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 
 #include "tiny_xml.hpp"
+#include <boost/config.hpp>
 #include <cassert>
 #include <cstring>
+#include <vector>
+#ifdef BOOST_HAS_UNISTD_H
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
 
 namespace
 {
@@ -85,170 +92,400 @@ namespace boost
 
       //  parse  -----------------------------------------------------------------//
 
-      element_ptr parse( std::istream & in, const std::string & msg )
+      namespace
       {
-         char c = 0;  // current character
-         element_ptr e( new element );
-
-         if(!in.get( c ))
-            throw std::string("xml: unexpected eof");
-         if ( c == '<' )
+         // Parses everything up to the end of the start tag, and leaves c at the
+         // first character after it.  Returns false if there is no content to
+         // follow (comments, processing instructions and empty elements).
+         bool parse_start( element & e, char & c, std::istream & in, const std::string & msg )
+         {
             if(!in.get( c ))
                throw std::string("xml: unexpected eof");
+            if ( c == '<' )
+               if(!in.get( c ))
+                  throw std::string("xml: unexpected eof");
 
-         if(c == '!')
-         {
-            eat_comment(c, in);
-            return e;
-         }
-         if(c == '?')
-         {
-            // XML processing instruction.
-            e->name += c;
-            if(!in.get( c )) // next char
-               throw std::string("xml: unexpected eof");
-            e->name += get_name(c, in);
-            in >> std::ws;
-            if(!in.get( c )) // next char
-               throw std::string("xml: unexpected eof");
-            while(c != '?')
+            if(c == '!')
+            {
+               eat_comment(c, in);
+               return false;
+            }
+            if(c == '?')
             {
-               e->content += c;
+               // XML processing instruction.
+               e.name += c;
+               if(!in.get( c )) // next char
+                  throw std::string("xml: unexpected eof");
+               e.name += get_name(c, in);
+               in >> std::ws;
+               if(!in.get( c )) // next char
+                  throw std::string("xml: unexpected eof");
+               while(c != '?')
+               {
+                  e.content += c;
+                  if(!in.get( c )) // next char
+                     throw std::string("xml: unexpected eof");
+               }
                if(!in.get( c )) // next char
                   throw std::string("xml: unexpected eof");
+               if(c != '>')
+                  throw std::string("Invalid XML processing instruction.");
+               return false;
             }
-            if(!in.get( c )) // next char
-               throw std::string("xml: unexpected eof");
-            if(c != '>')
-               throw std::string("Invalid XML processing instruction.");
-            return e;
-         }
 
-         e->name = get_name( c, in );
-         eat_whitespace( c, in );
+            e.name = get_name( c, in );
+            eat_whitespace( c, in );
 
-         // attributes
-         while ( (c != '>') && (c != '/') )
-         {
-            attribute a;
-            a.name = get_name( c, in );
+            // attributes
+            while ( (c != '>') && (c != '/') )
+            {
+               attribute a;
+               a.name = get_name( c, in );
 
-            eat_delim( c, in, '=', msg );
-            eat_delim( c, in, '\"', msg );
+               eat_delim( c, in, '=', msg );
+               eat_delim( c, in, '\"', msg );
 
-            a.value = get_value( c, in );
+               a.value = get_value( c, in );
 
-            e->attributes.push_back( a );
-            eat_whitespace( c, in );
+               e.attributes.push_back( a );
+               eat_whitespace( c, in );
+            }
+            if(c == '/')
+            {
+               if(!in.get( c )) // next after '/'
+                  throw std::string("xml: unexpected eof");
+               eat_whitespace( c, in );
+               if(c != '>')
+                  throw std::string("xml: unexpected /");
+               return false;
+            }
+            if(!in.get( c )) // next after '>'
+               throw std::string("xml: unexpected eof");
+            return true;
          }
-         if(c == '/')
+
+         // Parses a run of text content of e, c is at its first character.
+         element_ptr parse_text( const element_ptr & e, char & c, std::istream & in )
          {
-            if(!in.get( c )) // next after '/'
-               throw std::string("xml: unexpected eof");
-            eat_whitespace( c, in );
-            if(c != '>')
-               throw std::string("xml: unexpected /");
-            return e;
+            element_ptr sub( new element );
+            while ( c != '<' )
+            {
+               sub->content += c;
+               if(!in.get( c ))
+                  throw std::string("xml: unexpected eof");
+            }
+            sub->parent = e;
+            return sub;
          }
-         if(!in.get( c )) // next after '>'
-            throw std::string("xml: unexpected eof");
 
-         //eat_whitespace( c, in );
+         // Parses the end tag of e, c is at the opening '<'.
+         void parse_end( const element & e, char & c, std::istream & in, const std::string & msg )
+         {
+            in.get(c);
+            eat_delim( c, in, '/', msg );
+            std::string end_name( get_name( c, in ) );
+            if ( e.name != end_name )
+               throw std::string("xml syntax error: beginning name ")
+               + e.name + " did not match end name " + end_name
+               + " (" + msg + ")";
 
-         do{
-            // sub-elements
-            while ( c == '<' )
+            eat_delim( c, in, '>', msg );
+            if(c != '>')
             {
-               if ( in.peek() == '/' ) 
-                  break;
-               element_ptr child(parse( in, msg ));
-               child->parent = e;
-               e->elements.push_back(child);
-               in.get( c ); // next after '>'
-               //eat_whitespace( c, in );
+               // we've eaten one character past the >, put it back:
+               if(!in.putback(c))
+                  throw std::string("Unable to put back character");
             }
-            if (( in.peek() == '/' ) && (c == '<'))
-               break;
+         }
 
-            // content
-            if ( (c != '<') )
+         // Parses the content and end tag of e, whose start tag has been read,
+         // and leaves the stream positioned just after the end tag.
+         void parse_content( const element_ptr & e, char & c, std::istream & in, const std::string & msg )
+         {
+            //
+            // The elements whose content we're in the middle of, kept on an explicit
+            // stack so that there's no limit on how deeply nested they can be:
+            //
+            std::vector<element_ptr> stack( 1, e );
+            while ( !stack.empty() )
             {
-               element_ptr sub( new element );
-               while ( c != '<' )
+               const element_ptr top = stack.back();
+               if ( c != '<' )
+                  top->elements.push_back( parse_text( top, c, in ) );
+               else if ( in.peek() == '/' )
                {
-                  sub->content += c;
-                  if(!in.get( c ))
-                     throw std::string("xml: unexpected eof");
+                  parse_end( *top, c, in, msg );
+                  stack.pop_back();
+                  if ( !stack.empty() )
+                     in.get( c ); // next after '>'
+               }
+               else
+               {
+                  element_ptr child( new element );
+                  child->parent = top;
+                  top->elements.push_back( child );
+                  if ( parse_start( *child, c, in, msg ) )
+                     stack.push_back( child );
+                  else
+                     in.get( c ); // next after '>'
                }
-               sub->parent = e;
-               e->elements.push_back( sub );
             }
+         }
+      }
 
-            assert( c == '<' );
-            if( in.peek() == '/' )
-               break;
-         }while(true);
+      element_ptr parse( std::istream & in, const std::string & msg )
+      {
+         char c = 0;  // current character
+         element_ptr root( new element );
 
-         in.get(c);
-         eat_delim( c, in, '/', msg );
-         std::string end_name( get_name( c, in ) );
-         if ( e->name != end_name )
-            throw std::string("xml syntax error: beginning name ")
-            + e->name + " did not match end name " + end_name
-            + " (" + msg + ")";
-
-         eat_delim( c, in, '>', msg );
-         if(c != '>')
+         if ( parse_start( *root, c, in, msg ) )
+            parse_content( root, c, in, msg );
+         return root;
+      }
+
+      //  child_parser  --------------------------------------------------------//
+
+      child_parser::child_parser( std::istream & in, const std::string & msg )
+         : m_in( in ), m_msg( msg ), m_root( new element ), m_c( 0 )
+      {
+         if ( parse_start( *m_root, m_c, m_in, m_msg ) )
+            m_open.push_back( m_root );
+      }
+
+      element_ptr child_parser::next( bool (*open)( const std::string & name ) )
+      {
+         if ( m_open.empty() )
+            return element_ptr();
+         const element_ptr e = m_open.back();
+         if ( m_c != '<' )
+            return parse_text( e, m_c, m_in );
+         if ( m_in.peek() == '/' )
+         {
+            parse_end( *e, m_c, m_in, m_msg );
+            m_open.pop_back();
+            if ( !m_open.empty() )
+               m_in.get( m_c ); // next after '>'
+            return element_ptr();
+         }
+         element_ptr child( new element );
+         child->parent = e;
+         if ( parse_start( *child, m_c, m_in, m_msg ) )
          {
-            // we've eaten one character past the >, put it back:
-            if(!in.putback(c))
-               throw std::string("Unable to put back character");
+            if ( open && open( child->name ) )
+            {
+               // Its children come next:
+               m_open.push_back( child );
+               return child;
+            }
+            parse_content( child, m_c, m_in, m_msg );
          }
-         return e;
+         m_in.get( m_c ); // next after '>'
+         return child;
       }
 
       //  write  ---------------------------------------------------------------//
 
       void write( const element & e, std::ostream & out )
       {
-         if(e.name.size())
+         writer w( out );
+         w.write( e );
+      }
+
+      //  writer  --------------------------------------------------------------//
+
+      writer::writer( std::ostream & out, std::size_t flush_size )
+         : m_flush_size( flush_size ), m_stream( &out ), m_owned_stream( 0 ), m_fd( -1 )
+      {
+         m_buffer.reserve( m_flush_size );
+      }
+
+      writer::writer( const std::string & file_name, std::size_t flush_size )
+         : m_flush_size( flush_size ), m_stream( 0 ), m_owned_stream( 0 ), m_fd( -1 )
+      {
+#ifdef BOOST_HAS_UNISTD_H
+         m_fd = ::open( file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+         if ( m_fd < 0 )
+            throw std::string("Unable to create output file ") + file_name;
+#else
+         m_owned_stream = new std::ofstream( file_name.c_str() );
+         if ( !m_owned_stream->good() )
          {
-            out << "<" << e.name;
-            if ( !e.attributes.empty() )
+            delete m_owned_stream;
+            throw std::string("Unable to create output file ") + file_name;
+         }
+         m_stream = m_owned_stream;
+#endif
+         m_buffer.reserve( m_flush_size );
+      }
+
+      writer::~writer()
+      {
+         try
+         {
+            flush();
+         }
+         catch(...) {}
+#ifdef BOOST_HAS_UNISTD_H
+         if ( m_fd >= 0 )
+            ::close( m_fd );
+#endif
+         delete m_owned_stream;
+      }
+
+      void writer::write_out( const char * p, std::size_t n )
+      {
+#ifdef BOOST_HAS_UNISTD_H
+         if ( m_fd >= 0 )
+         {
+            while ( n )
             {
-               for( attribute_list::const_iterator itr = e.attributes.begin();
-                  itr != e.attributes.end(); ++itr )
+               ssize_t r = ::write( m_fd, p, n );
+               if ( r < 0 )
                {
-                  out << " " << itr->name << "=\"" << itr->value << "\"";
+                  if ( errno == EINTR )
+                     continue;
+                  throw std::string("xml: error writing output file");
                }
+               p += r;
+               n -= static_cast<std::size_t>(r);
             }
-            if(e.name[0] == '?')
+            return;
+         }
+#endif
+         m_stream->write( p, n );
+      }
+
+      void writer::flush()
+      {
+         if ( !m_buffer.empty() )
+         {
+            write_out( m_buffer.data(), m_buffer.size() );
+            m_buffer.clear();
+         }
+         if ( m_stream )
+            m_stream->flush();
+      }
+
+      void writer::append( const char * p, std::size_t n )
+      {
+         if ( m_buffer.size() + n > m_flush_size )
+         {
+            if ( !m_buffer.empty() )
             {
-               out << " " << e.content << "?>";
-               return;
+               write_out( m_buffer.data(), m_buffer.size() );
+               m_buffer.clear();
             }
-            if(e.elements.empty() && e.content.empty())
+            if ( n >= m_flush_size )
             {
-               out << "/>";
+               // Too big to be worth buffering:
+               write_out( p, n );
                return;
             }
-            out << ">";
          }
-         if ( !e.elements.empty() )
+         m_buffer.append( p, n );
+      }
+
+      void writer::write( const std::string & text )
+      {
+         append( text );
+      }
+
+      void writer::write( const char * text, std::size_t n )
+      {
+         append( text, n );
+      }
+
+      void writer::write_start( const element & e )
+      {
+         write_tag( e );
+         append( ">", 1 );
+      }
+
+      void writer::write_end( const element & e )
+      {
+         append( "</", 2 );
+         append( e.name );
+         append( ">", 1 );
+      }
+
+      // Writes the start tag of e with its attributes, but not what closes it.
+      void writer::write_tag( const element & e )
+      {
+         append( "<", 1 );
+         append( e.name );
+         for( attribute_list::const_iterator itr = e.attributes.begin();
+            itr != e.attributes.end(); ++itr )
+         {
+            append( " ", 1 );
+            append( itr->name );
+            append( "=\"", 2 );
+            append( itr->value );
+            append( "\"", 1 );
+         }
+      }
+
+      // Writes everything up to the children of e, returns false if that's
+      // all there is to e.
+      bool writer::write_open( const element & e )
+      {
+         if(e.name.size())
          {
-            for( element_list::const_iterator itr = e.elements.begin();
-               itr != e.elements.end(); ++itr )
+            if(e.name[0] == '?')
+            {
+               write_tag( e );
+               append( " ", 1 );
+               append( e.content );
+               append( "?>", 2 );
+               return false;
+            }
+            if(e.elements.empty() && e.content.empty())
             {
-               write( **itr, out );
+               write_tag( e );
+               append( "/>", 2 );
+               return false;
             }
+            write_start( e );
          }
+         return true;
+      }
+
+      // Writes whatever follows the children of e.
+      void writer::write_close( const element & e )
+      {
          if ( !e.content.empty() )
          {
-            out << e.content;
+            append( e.content );
          }
          if(e.name.size() && (e.name[0] != '?'))
          {
-            out << "</" << e.name << ">";
+            append( "</", 2 );
+            append( e.name );
+            append( ">", 1 );
+         }
+      }
+
+      void writer::write( const element & e )
+      {
+         // Walk the tree with an explicit stack, so that there's no limit on how
+         // deeply nested it can be:
+         typedef std::pair<const element *, element_list::const_iterator> frame;
+         if ( !write_open( e ) )
+            return;
+         std::vector<frame> stack( 1, frame( &e, e.elements.begin() ) );
+         while ( !stack.empty() )
+         {
+            frame & f = stack.back();
+            if ( f.second != f.first->elements.end() )
+            {
+               const element & child = **f.second++;
+               if ( write_open( child ) )
+                  stack.push_back( frame( &child, child.elements.begin() ) );
+            }
+            else
+            {
+               write_close( *f.first );
+               stack.pop_back();
+            }
          }
       }
 
@@ -18,7 +18,10 @@
 #include "boost/utility.hpp"   // for noncopyable
 #include <list>
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
+#include <cstddef>
 
 namespace boost
 {
@@ -72,8 +75,83 @@ namespace boost
       // Throws: std::string on syntax error. msg appended to what() string.
       element_ptr parse( std::istream & in, const std::string & msg );
 
+      // Parses an element one child at a time, so that the children can be
+      // handed on for further processing while the rest of the stream is
+      // still being read.
+      // Precondition: as for parse().
+      // Throws: std::string on syntax error.
+      class child_parser
+         : private boost::noncopyable
+      {
+      public:
+         // Reads the start tag of the element.
+         child_parser( std::istream & in, const std::string & msg );
+
+         // The element being parsed, its list of sub-elements is not filled in.
+         element_ptr root()const { return m_root; }
+         // Returns the next sub-element of the innermost element still open
+         // (initially root()), with its parent set, or a null pointer once that
+         // element's end tag has been read, which closes it.  A sub-element
+         // for which open(name) returns true, and which isn't empty, is
+         // returned with only its start tag read, and becomes the innermost
+         // open element; all others are returned complete.
+         element_ptr next( bool (*open)( const std::string & name ) = 0 );
+         // The number of elements open, 0 once root() is complete.
+         std::size_t depth()const { return m_open.size(); }
+
+      private:
+         std::istream &    m_in;
+         std::string       m_msg;
+         element_ptr       m_root;
+         char              m_c;
+         std::vector<element_ptr> m_open;
+      };
+
       void write( const element & e, std::ostream & out );
 
+      // Serializes elements into a large reusable buffer, which is only
+      // handed to the underlying stream or file once it reaches flush_size
+      // bytes.  Output is byte-for-byte the same as write() above.  Finished
+      // subtrees may be written at any time, so output can be emitted while
+      // the rest of the document is still being processed.
+      class writer
+         : private boost::noncopyable
+      {
+      public:
+         static const std::size_t default_flush_size = 1024 * 1024;
+
+         explicit writer( std::ostream & out, std::size_t flush_size = default_flush_size );
+         // Creates file_name, writing to the file descriptor directly where
+         // the platform has one, and through a std::ofstream otherwise.
+         // Throws: std::string if the file can not be created.
+         explicit writer( const std::string & file_name, std::size_t flush_size = default_flush_size );
+         ~writer();
+
+         void write( const element & e );
+         void write( const std::string & text );
+         void write( const char * text, std::size_t n );
+         // Writes just the start or end tag of e, for use when the children
+         // of e are written separately.
+         void write_start( const element & e );
+         void write_end( const element & e );
+         // Hands everything buffered so far to the stream or file.
+         void flush();
+
+      private:
+         void write_tag( const element & e );
+         bool write_open( const element & e );
+         void write_close( const element & e );
+         void append( const char * p, std::size_t n );
+         void append( const std::string & s ) { append( s.data(), s.size() ); }
+         void write_out( const char * p, std::size_t n );
+
+         std::string       m_buffer;
+         std::size_t       m_flush_size;
+         std::ostream *    m_stream;
+         std::ofstream *   m_owned_stream;
+         int               m_fd;
+      };
+
    }
 }
 
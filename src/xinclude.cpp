@@ -0,0 +1,350 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Following xi:include elements with --xinclude: worker threads parse each
+// included file and search its text for the index terms, while this thread
+// indexes the document, so that by the time we reach an xi:include most of the
+// work on the file it includes has been done.
+//
+// The index entries are still created here, in document order, so that the
+// index is just the same as if each file had been pasted in place of its
+// xi:include.  Each included file is written next to the original, with
+// ".auto_index" inserted before the extension, and the href of the xi:include
+// changed to refer to it.
+//
+
+#include "auto_index.hpp"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <deque>
+
+namespace
+{
+   struct include_unit
+   {
+      std::string file;                    // The file included.
+      std::string output;                  // Where it's written once indexed.
+      boost::tiny_xml::element* include;   // The xi:include.
+      include_unit* parent;                // The file containing the xi:include, null for the document.
+      file_identity id;
+      bool have_id;
+      bool claimed;                        // Someone is loading it.
+      bool ready;                          // They've finished.
+      std::string header;
+      boost::tiny_xml::element_ptr root;
+      prematched_terms terms;
+      boost::exception_ptr error;
+
+      include_unit() : include(0), parent(0), have_id(false), claimed(false), ready(false) {}
+   };
+   typedef boost::shared_ptr<include_unit> include_ptr;
+
+   class include_follower
+   {
+   public:
+      include_follower() : m_stop(false) {}
+
+      void begin(const boost::tiny_xml::element_ptr& root, const std::string& file, const std::string& output);
+      boost::tiny_xml::element_ptr find(const boost::tiny_xml::element* include, const prematched_terms*& terms);
+      void write();
+      void work();
+      void stop();
+   private:
+      void add_includes(const boost::tiny_xml::element_ptr& root, include_unit* parent);
+      void load(include_unit& u);
+      void wait_for(include_unit& u);
+
+      include_unit m_document;
+      boost::mutex m_mutex;
+      boost::condition_variable m_cond;
+      std::deque<include_ptr> m_queue;
+      boost::unordered_map<const boost::tiny_xml::element*, include_ptr> m_units;
+      std::vector<include_ptr> m_used;    // In the order they were indexed.
+      boost::thread_group m_workers;
+      bool m_stop;
+   };
+
+   struct include_thread
+   {
+      include_follower* follower;
+      void operator()()const { follower->work(); }
+   };
+
+   boost::scoped_ptr<include_follower> follower;
+
+   void capture_exception(boost::exception_ptr& error)
+   {
+      try
+      {
+         throw;
+      }
+      catch(const std::string& s)
+      {
+         // tiny_xml reports syntax errors by throwing strings:
+         error = boost::copy_exception(s);
+      }
+      catch(const std::runtime_error& e)
+      {
+         error = boost::copy_exception(e);
+      }
+      catch(...)
+      {
+         error = boost::current_exception();
+      }
+   }
+   //
+   // Only includes of whole XML files are followed, not those of text, parts
+   // of files, or anything that isn't a local file:
+   //
+   const std::string* followed_href(const boost::tiny_xml::element_ptr& node)
+   {
+      if(node->name != "xi:include")
+         return 0;
+      const std::string* href = find_attr(node, "href");
+      const std::string* parse = find_attr(node, "parse");
+      if(!href || href->empty() || (href->find("://") != std::string::npos) || find_attr(node, "xpointer") || (parse && (*parse != "xml")))
+         return 0;
+      return href;
+   }
+
+   std::string output_file(const std::string& file)
+   {
+      boost::filesystem::path p(file);
+      return (p.parent_path() / (p.stem().string() + ".auto_index" + p.extension().string())).string();
+   }
+   //
+   // Searches all the text in root that process_node will search, as enter_node
+   // and leave_node would:
+   //
+   void prematch_terms(const boost::tiny_xml::element_ptr& root, prematched_terms& terms)
+   {
+      typedef std::pair<boost::tiny_xml::element_ptr, bool> item;  // The element, and whether its text has been seen.
+      std::vector<item> stack(1, item(root, false));
+      term_hits hits;
+      while(!stack.empty())
+      {
+         item i = stack.back();
+         stack.pop_back();
+         const boost::tiny_xml::element& e = *i.first;
+         if(e.name.size() && (e.name[0] == '?'))
+            continue;
+         bool flatten = should_flatten_node(e.name.c_str());
+         if(!i.second)
+         {
+            std::string text = flatten ? unescape_xml(get_consolidated_content(i.first)) : e.content;
+            if(text.size() && !is_whitespace(text) && !terms.count(text))
+            {
+               match_terms(text, hits);
+               terms[text] = hits;
+            }
+         }
+         for(boost::tiny_xml::element_list::const_iterator c = e.elements.begin(); c != e.elements.end(); ++c)
+            stack.push_back(item(*c, i.second || flatten));
+      }
+   }
+
+   void include_follower::add_includes(const boost::tiny_xml::element_ptr& root, include_unit* parent)
+   {
+      std::vector<boost::tiny_xml::element_ptr> stack(1, root);
+      while(!stack.empty())
+      {
+         boost::tiny_xml::element_ptr node = stack.back();
+         stack.pop_back();
+         if(const std::string* href = followed_href(node))
+         {
+            include_ptr u(new include_unit);
+            u->file = (boost::filesystem::path(parent->file).parent_path() / *href).string();
+            u->output = output_file(u->file);
+            u->include = node.get();
+            u->parent = parent;
+            u->have_id = get_file_identity(u->file, u->id);
+            if(u->have_id)
+            {
+               u->id.size = 0;
+               u->id.modified = 0;
+               for(const include_unit* p = parent; p; p = p->parent)
+               {
+                  if(p->have_id && !(p->id < u->id) && !(u->id < p->id))
+                     throw std::runtime_error("The file " + u->file + " includes itself.");
+               }
+            }
+            boost::mutex::scoped_lock l(m_mutex);
+            m_units[node.get()] = u;
+            m_queue.push_back(u);
+            m_cond.notify_one();
+         }
+         // Any xi:fallback children are searched too, as process_node will:
+         for(boost::tiny_xml::element_list::const_reverse_iterator i = node->elements.rbegin(); i != node->elements.rend(); ++i)
+            stack.push_back(*i);
+      }
+   }
+
+   void include_follower::load(include_unit& u)
+   {
+      boost::exception_ptr error;
+      try
+      {
+         std::ifstream is(u.file.c_str());
+         if((0 == is.peek()) || !is.good())
+            throw std::runtime_error("Unable to open included XML file " + u.file);
+         u.header = get_header(is);
+         u.root = boost::tiny_xml::parse(is, "");
+         add_includes(u.root, &u);
+         prematch_terms(u.root, u.terms);
+      }
+      catch(...)
+      {
+         capture_exception(error);
+      }
+      boost::mutex::scoped_lock l(m_mutex);
+      u.error = error;
+      u.ready = true;
+      m_cond.notify_all();
+   }
+
+   void include_follower::work()
+   {
+      boost::mutex::scoped_lock l(m_mutex);
+      while(true)
+      {
+         while(!m_stop && m_queue.empty())
+            m_cond.wait(l);
+         if(m_stop)
+            return;
+         include_ptr u = m_queue.front();
+         m_queue.pop_front();
+         if(u->claimed)
+            continue;
+         u->claimed = true;
+         l.unlock();
+         load(*u);
+         l.lock();
+      }
+   }
+
+   void include_follower::wait_for(include_unit& u)
+   {
+      boost::mutex::scoped_lock l(m_mutex);
+      if(!u.claimed)
+      {
+         // Nobody has started on it yet, so it's quicker to do it ourselves:
+         u.claimed = true;
+         l.unlock();
+         load(u);
+         l.lock();
+      }
+      while(!u.ready)
+         m_cond.wait(l);
+      if(u.error)
+         boost::rethrow_exception(u.error);
+   }
+
+   void include_follower::begin(const boost::tiny_xml::element_ptr& root, const std::string& file, const std::string& output)
+   {
+      m_document.file = file;
+      m_document.output = output;
+      m_document.have_id = get_file_identity(file, m_document.id);
+      m_document.id.size = 0;
+      m_document.id.modified = 0;
+      unsigned n = boost::thread::hardware_concurrency();
+      n = n < 1 ? 1 : n > 8 ? 8 : n;
+      for(unsigned i = 0; i < n; ++i)
+      {
+         include_thread t = { this };
+         m_workers.create_thread(t);
+      }
+      add_includes(root, &m_document);
+   }
+
+   boost::tiny_xml::element_ptr include_follower::find(const boost::tiny_xml::element* include, const prematched_terms*& terms)
+   {
+      include_ptr u;
+      {
+         boost::mutex::scoped_lock l(m_mutex);
+         boost::unordered_map<const boost::tiny_xml::element*, include_ptr>::const_iterator pos = m_units.find(include);
+         if(pos == m_units.end())
+            return boost::tiny_xml::element_ptr();
+         u = pos->second;
+      }
+      wait_for(*u);
+      if(verbose)
+         std::cout << "Indexing included file: " << u->file << std::endl;
+      m_used.push_back(u);
+      terms = &u->terms;
+      return u->root;
+   }
+
+   void include_follower::write()
+   {
+      stop();
+      //
+      // Point each xi:include at the indexed copy of its file, relative to
+      // the indexed copy of the file containing it:
+      //
+      for(std::vector<include_ptr>::const_iterator i = m_used.begin(); i != m_used.end(); ++i)
+      {
+         include_unit& u = **i;
+         boost::filesystem::path output = boost::filesystem::absolute(u.output);
+         boost::filesystem::path href = boost::filesystem::relative(output, boost::filesystem::absolute(u.parent->output).parent_path());
+         if(href.empty())
+            href = output;
+         for(boost::tiny_xml::attribute_list::iterator a = u.include->attributes.begin(); a != u.include->attributes.end(); ++a)
+         {
+            if(a->name == "href")
+               a->value = href.generic_string();
+         }
+      }
+      for(std::vector<include_ptr>::const_iterator i = m_used.begin(); i != m_used.end(); ++i)
+      {
+         boost::tiny_xml::writer os((*i)->output);
+         os.write((*i)->header + "\n");
+         os.write(*(*i)->root);
+         os.flush();
+      }
+   }
+
+   void include_follower::stop()
+   {
+      {
+         boost::mutex::scoped_lock l(m_mutex);
+         m_stop = true;
+         m_queue.clear();
+         m_cond.notify_all();
+      }
+      m_workers.join_all();
+   }
+}
+
+void begin_includes(const boost::tiny_xml::element_ptr& root, const std::string& file, const std::string& output)
+{
+   follower.reset(new include_follower);
+   follower->begin(root, file, output);
+}
+
+boost::tiny_xml::element_ptr included_document(const boost::tiny_xml::element* include, const prematched_terms*& terms)
+{
+   if(!follower)
+      return boost::tiny_xml::element_ptr();
+   return follower->find(include, terms);
+}
+
+void write_included_documents()
+{
+   if(follower)
+      follower->write();
+}
+
+void end_includes()
+{
+   if(follower)
+      follower->stop();
+}
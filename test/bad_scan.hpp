@@ -0,0 +1,5 @@
+// Terms for the bad_scan test, the scanner in bad_scan.idx turns the
+// second one into a search regex with an unbalanced parenthesis:
+TERM(widget)
+TERM(gad(get)
+TERM(gadget)
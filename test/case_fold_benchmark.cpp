@@ -0,0 +1,100 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Compares searching for script-style terms "\<term\>" with case insensitive
+// expressions, against searching the case folded text the way lazy_regex does.
+//
+// Usage: case_fold_benchmark [docbook-file [number-of-terms]]
+//
+
+#include "../src/lazy_regex.hpp"
+#include <boost/regex.hpp>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+   const char* file = argc > 1 ? argv[1] : "type_traits.docbook";
+   std::size_t max_terms = argc > 2 ? std::atoi(argv[2]) : 500;
+
+   std::ifstream is(file);
+   if(!is)
+   {
+      std::cerr << "Unable to open " << file << std::endl;
+      return 1;
+   }
+   std::string doc((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+   //
+   // Break the document into the blocks of text between the tags, and take
+   // the terms from the distinct words within them:
+   //
+   std::vector<std::string> blocks;
+   boost::sregex_token_iterator i(doc.begin(), doc.end(), boost::regex("<[^>]*>"), -1), j;
+   for(; i != j; ++i)
+   {
+      if(i->length() > 1)
+         blocks.push_back(i->str());
+   }
+   std::set<std::string> words;
+   static const boost::regex word_re("[[:alpha:]_]\\w{3,}");
+   for(std::vector<std::string>::const_iterator b = blocks.begin(); (b != blocks.end()) && (words.size() < max_terms); ++b)
+   {
+      boost::sregex_iterator w(b->begin(), b->end(), word_re), end;
+      for(; (w != end) && (words.size() < max_terms); ++w)
+         words.insert(w->str());
+   }
+
+   std::vector<boost::regex> icase_terms;
+   std::vector<lazy_regex> folded_terms;
+   for(std::set<std::string>::const_iterator w = words.begin(); w != words.end(); ++w)
+   {
+      std::string s = "\\<" + *w + "\\>";
+      icase_terms.push_back(boost::regex(s, boost::regex::icase | boost::regex::perl));
+      folded_terms.push_back(lazy_regex(s, boost::regex::icase | boost::regex::perl));
+      if(!folded_terms.back().case_folded() || !folded_terms.back().get())
+      {
+         std::cerr << "Term " << s << " was not case folded" << std::endl;
+         return 1;
+      }
+   }
+
+   std::size_t icase_hits = 0;
+   std::clock_t start = std::clock();
+   for(std::vector<std::string>::const_iterator b = blocks.begin(); b != blocks.end(); ++b)
+   {
+      for(std::vector<boost::regex>::const_iterator e = icase_terms.begin(); e != icase_terms.end(); ++e)
+         icase_hits += boost::regex_search(*b, *e);
+   }
+   double icase_time = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+   std::size_t folded_hits = 0;
+   std::string folded;
+   start = std::clock();
+   for(std::vector<std::string>::const_iterator b = blocks.begin(); b != blocks.end(); ++b)
+   {
+      fold_case(*b, folded);
+      for(std::vector<lazy_regex>::const_iterator e = folded_terms.begin(); e != folded_terms.end(); ++e)
+         folded_hits += e->search(folded);
+   }
+   double folded_time = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+   std::cout << blocks.size() << " blocks of text, " << words.size() << " terms" << std::endl;
+   std::cout << "Case insensitive: " << icase_time << "s, " << icase_hits << " hits" << std::endl;
+   std::cout << "Case folded:      " << folded_time << "s, " << folded_hits << " hits" << std::endl;
+   if(icase_hits != folded_hits)
+   {
+      std::cerr << "Error: the number of hits differ" << std::endl;
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,57 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Writes a deeply nested document - sections within sections, each with a
+// title and a paragraph - or with --indexed, what AutoIndex should make of it
+// with terms.idx, so that the test doesn't need gold files tens of megabytes
+// in size.
+//
+// Usage: deep_document [--indexed] depth file
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+   bool indexed = (argc > 1) && (std::strcmp(argv[1], "--indexed") == 0);
+   if(argc != (indexed ? 4 : 3))
+   {
+      std::cerr << "Usage: deep_document [--indexed] depth file" << std::endl;
+      return 1;
+   }
+   int depth = std::atoi(argv[indexed ? 2 : 1]);
+   std::ofstream os(argv[indexed ? 3 : 2]);
+
+   os << "<?xml version=\"1.0\"?>\n";
+   if(indexed)
+      os << "\n";
+   os << "<chapter id=\"deep\"><title>Deep</title>\n";
+   for(int i = 0; i < depth; ++i)
+   {
+      os << "<section id=\"deep.s" << i << "\">";
+      if(indexed)
+      {
+         static const char* const terms[] = { "widget", "gadget" };
+         for(int t = 0; t < 2; ++t)
+         {
+            os << "<indexterm><primary>" << terms[t] << "</primary><secondary>Level " << i << "</secondary></indexterm>"
+               << "<indexterm><primary>Level " << i << "</primary><secondary>" << terms[t] << "</secondary></indexterm>";
+         }
+      }
+      os << "<title>Level " << i << "</title><para>A widget at level " << i << " of the gadget.</para>\n";
+   }
+   for(int i = 0; i < depth; ++i)
+      os << "</section>";
+   os << "\n</chapter>";
+   if(!indexed)
+      os << "\n";
+   return os.good() ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Times parsing and writing a pathologically deeply nested document - sections
+// within sections, each with a title and a paragraph - and optionally indexing it
+// with AutoIndex as well, reporting the time taken and the peak memory used.
+//
+// Usage: deep_document_benchmark [depth [path-to-auto_index]]
+//
+// The document is left behind in deep_document.xml, along with a script
+// deep_document.idx that indexes a couple of words in it.
+//
+
+#include "../src/tiny_xml.hpp"
+#include <boost/config.hpp>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef BOOST_HAS_UNISTD_H
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+   // Reports the peak memory, and for child processes the CPU time, where we can:
+   void report_usage(const char* what, bool children)
+   {
+#ifdef BOOST_HAS_UNISTD_H
+      rusage usage;
+      if(getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &usage) == 0)
+      {
+         std::cout << what << " peak memory: " << usage.ru_maxrss << "K";
+         if(children)
+            std::cout << ", CPU time: " << (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+               + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1.0e6) << "s";
+         std::cout << std::endl;
+      }
+#else
+      (void)what;
+      (void)children;
+#endif
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   int depth = argc > 1 ? std::atoi(argv[1]) : 100000;
+   const char* auto_index = argc > 2 ? argv[2] : 0;
+
+   {
+      std::ofstream os("deep_document.xml");
+      os << "<?xml version=\"1.0\"?>\n<chapter id=\"deep\"><title>Deep</title>\n";
+      for(int i = 0; i < depth; ++i)
+         os << "<section id=\"deep.s" << i << "\"><title>Level " << i << "</title><para>A widget at level " << i << " of the gadget.</para>\n";
+      for(int i = 0; i < depth; ++i)
+         os << "</section>";
+      os << "\n</chapter>\n";
+      std::ofstream script("deep_document.idx");
+      script << "widget\ngadget\n";
+   }
+
+   std::clock_t start = std::clock();
+   std::ifstream is("deep_document.xml");
+   std::string header;
+   std::getline(is, header);
+   boost::tiny_xml::element_ptr doc = boost::tiny_xml::parse(is, "deep_document.xml");
+   double parse_time = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+   start = std::clock();
+   std::ostringstream os;
+   boost::tiny_xml::write(*doc, os);
+   double write_time = double(std::clock() - start) / CLOCKS_PER_SEC;
+
+   std::cout << "Depth " << depth << ": parsed in " << parse_time << "s, written (" << os.str().size() << " bytes) in " << write_time << "s" << std::endl;
+   report_usage("Parse and write", false);
+
+   if(auto_index)
+   {
+      std::string command = std::string("\"") + auto_index + "\" --in=deep_document.xml --script=deep_document.idx --out=deep_document.out.xml";
+      int result = std::system(command.c_str());
+      std::cout << "AutoIndex exited with " << result << std::endl;
+      report_usage("AutoIndex", true);
+      if(result)
+         return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Compares escape_to_xml, unescape_xml and the whitespace test as they were
+// (a character at a time, and with regular expressions) against the versions
+// in text_kernels.cpp at each level the processor supports, on the blocks of
+// text between the tags of a document.
+//
+// Usage: text_kernels_benchmark [docbook-file [repeats]]
+//
+
+#include "../src/text_kernels.hpp"
+#include <boost/regex.hpp>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+namespace
+{
+   std::string old_escape_to_xml(const std::string& in)
+   {
+      std::string result;
+      for(std::string::size_type i = 0; i < in.size(); ++i)
+      {
+         switch(in[i])
+         {
+         case '&':
+            result.append("&amp;");
+            break;
+         case '<':
+            result.append("&lt;");
+            break;
+         case '>':
+            result.append("&gt;");
+            break;
+         case '"':
+            result.append("&quot;");
+            break;
+         default:
+            result.append(1, in[i]);
+         }
+      }
+      return result;
+   }
+   std::string old_unescape_xml(const std::string& s)
+   {
+      boost::regex e("&(?:(quot)|(amp)|(apos)|(lt)|(gt));");
+      return regex_replace(s, e, "(?1\")(?2&)(?3\')(?4<)(?5>)", boost::regex_constants::format_all);
+   }
+   bool old_is_whitespace(const std::string& s)
+   {
+      static const boost::regex space_re("[[:space:]]+");
+      return regex_match(s, space_re);
+   }
+
+   const char* level_names[] = { "scalar", "SSE2", "AVX2" };
+
+   // Runs all three over every block, returning a checksum so that nothing gets optimised away:
+   template <class Escape, class Unescape, class Whitespace>
+   std::size_t run(const char* name, const std::vector<std::string>& blocks, unsigned repeats, Escape escape, Unescape unescape, Whitespace whitespace)
+   {
+      std::size_t total = 0;
+      double times[3] = { 0, 0, 0 };
+      for(unsigned r = 0; r < repeats; ++r)
+      {
+         std::clock_t start = std::clock();
+         for(std::vector<std::string>::const_iterator b = blocks.begin(); b != blocks.end(); ++b)
+            total += escape(*b).size();
+         times[0] += double(std::clock() - start) / CLOCKS_PER_SEC;
+         start = std::clock();
+         for(std::vector<std::string>::const_iterator b = blocks.begin(); b != blocks.end(); ++b)
+            total += unescape(*b).size();
+         times[1] += double(std::clock() - start) / CLOCKS_PER_SEC;
+         start = std::clock();
+         for(std::vector<std::string>::const_iterator b = blocks.begin(); b != blocks.end(); ++b)
+            total += whitespace(*b);
+         times[2] += double(std::clock() - start) / CLOCKS_PER_SEC;
+      }
+      std::cout << name << ": escape " << times[0] << "s, unescape " << times[1] << "s, whitespace " << times[2] << "s" << std::endl;
+      return total;
+   }
+}
+
+int main(int argc, char* argv[])
+{
+   const char* file = argc > 1 ? argv[1] : "type_traits.docbook";
+   unsigned repeats = argc > 2 ? std::atoi(argv[2]) : 20;
+
+   std::ifstream is(file);
+   if(!is)
+   {
+      std::cerr << "Unable to open " << file << std::endl;
+      return 1;
+   }
+   std::string doc((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+   std::vector<std::string> blocks;
+   boost::sregex_token_iterator i(doc.begin(), doc.end(), boost::regex("<[^>]*>"), -1), j;
+   for(; i != j; ++i)
+   {
+      if(i->length())
+         blocks.push_back(i->str());
+   }
+   std::cout << blocks.size() << " blocks of text, " << repeats << " repeats" << std::endl;
+
+   std::size_t expected = run("Old", blocks, repeats, old_escape_to_xml, old_unescape_xml, old_is_whitespace);
+   for(int level = simd_scalar; level <= max_simd_level(); ++level)
+   {
+      use_simd_level(static_cast<simd_level>(level));
+      if(run(level_names[level], blocks, repeats, escape_to_xml, unescape_xml, is_whitespace) != expected)
+      {
+         std::cerr << "Error: the results differ" << std::endl;
+         return 1;
+      }
+   }
+   return 0;
+}
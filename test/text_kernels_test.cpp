@@ -0,0 +1,122 @@
+// Copyright 2026 agent
+//
+// Use, modification and distribution are subject to the
+// Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt
+// or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+//
+// Checks escape_to_xml, unescape_xml and is_whitespace at every level of
+// vectorisation the processor supports, against straightforward versions,
+// on random strings with the interesting characters at every position
+// either side of the 16 and 32 byte block boundaries.
+//
+
+#include "../src/text_kernels.hpp"
+#include <boost/core/lightweight_test.hpp>
+#include <boost/regex.hpp>
+#include <cstdlib>
+
+namespace
+{
+   std::string reference_escape(const std::string& in)
+   {
+      std::string result;
+      for(std::string::size_type i = 0; i < in.size(); ++i)
+      {
+         switch(in[i])
+         {
+         case '&':
+            result.append("&amp;");
+            break;
+         case '<':
+            result.append("&lt;");
+            break;
+         case '>':
+            result.append("&gt;");
+            break;
+         case '"':
+            result.append("&quot;");
+            break;
+         default:
+            result.append(1, in[i]);
+         }
+      }
+      return result;
+   }
+   std::string reference_unescape(const std::string& s)
+   {
+      boost::regex e("&(?:(quot)|(amp)|(apos)|(lt)|(gt));");
+      return regex_replace(s, e, "(?1\")(?2&)(?3\')(?4<)(?5>)", boost::regex_constants::format_all);
+   }
+   bool reference_is_whitespace(const std::string& s)
+   {
+      static const boost::regex space_re("[[:space:]]+");
+      return regex_match(s, space_re);
+   }
+
+   void check(const std::string& s)
+   {
+      BOOST_TEST_EQ(escape_to_xml(s), reference_escape(s));
+      BOOST_TEST_EQ(unescape_xml(s), reference_unescape(s));
+      BOOST_TEST_EQ(unescape_xml(escape_to_xml(s)), s);
+      if(s.size())
+         BOOST_TEST_EQ(is_whitespace(s), reference_is_whitespace(s));
+   }
+
+   void check_level(simd_level level)
+   {
+      use_simd_level(level);
+      BOOST_TEST_EQ(current_simd_level(), level);
+
+      BOOST_TEST(is_whitespace(""));
+      BOOST_TEST_EQ(escape_to_xml(""), "");
+      BOOST_TEST_EQ(unescape_xml("&amp;lt; &apos;&quot;&gt &unknown; &"), "&lt; '\"&gt &unknown; &");
+
+      static const char specials[] = "&<>\"; \t\n\v\f\r\x80\xff";
+      static const char* entities[] = { "&quot;", "&amp;", "&apos;", "&lt;", "&gt;", "&am", "&;" };
+      for(std::size_t len = 0; len <= 70; ++len)
+      {
+         // A single interesting character at each position in a block of letters or spaces:
+         for(std::size_t pos = 0; pos < len; ++pos)
+         {
+            for(const char* c = specials; *c; ++c)
+            {
+               std::string s(len, 'a');
+               s[pos] = *c;
+               check(s);
+               std::string t(len, ' ');
+               t[pos] = *c;
+               check(t);
+            }
+            for(unsigned e = 0; e < sizeof(entities) / sizeof(entities[0]); ++e)
+            {
+               std::string s(len, 'x');
+               s.replace(pos, std::string::npos, entities[e]);
+               check(s);
+            }
+         }
+         check(std::string(len, ' '));
+         check(std::string(len, '\n'));
+         // And a few random mixtures of them:
+         for(unsigned n = 0; n < 20; ++n)
+         {
+            std::string s;
+            for(std::size_t i = 0; i < len; ++i)
+               s.append(1, std::rand() % 3 ? specials[std::rand() % (sizeof(specials) - 1)] : char('a' + std::rand() % 26));
+            check(s);
+         }
+      }
+   }
+}
+
+int main()
+{
+   BOOST_TEST_EQ(current_simd_level(), max_simd_level());
+   for(int level = simd_scalar; level <= max_simd_level(); ++level)
+      check_level(static_cast<simd_level>(level));
+   // Asking for more than the processor supports gets the best it has:
+   use_simd_level(simd_avx2);
+   BOOST_TEST_EQ(current_simd_level(), max_simd_level());
+   return boost::report_errors();
+}